@@ -0,0 +1,83 @@
+// Benchmark: midpoint BVH builder vs the Morton-code linear builder (LBVH)
+//   - Midpoint : BVH::build(), serial top-down partitioning
+//   - LBVH-30  : 30-bit Morton codes, radix sort and subtrees on the pool
+//   - LBVH-63  : the same with 63-bit codes (finer grid for huge scenes)
+// For each scene size the table shows build time, SAH cost of the tree and the
+// time to render a 512x512 image with it, plus the pixels that differ from
+// the midpoint tree's image (ties between equally close objects only).
+//
+// Usage: LBVHBench [threads] [largest N]
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "BVH.h"
+#include "RandomScene.h"
+#include "Renderer.h"
+#include "Stopwatch.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+	const unsigned threads = argc > 1 ? atoi(argv[1]) : 0;
+	const int largest = argc > 2 ? atoi(argv[2]) : 1000000;
+	const int size = 512;
+
+	ThreadPool pool(threads);
+	Camera camera(Vector3(1.6, 1.3, 1.6), Vector3(0, 0, 0), Vector3(0, 1, 0), size, size);
+	printf("LBVH benchmark on %d threads, %dx%d renders\n", (int)pool.size(), size, size);
+	printf("| %-8s | %-9s | %-14s | %-8s | %-10s | %-15s | %-12s |\n", "N", "Builder", "Build Time (s)", "Speedup",
+		   "SAH Cost", "Render Time (s)", "Diff Pixels");
+	printf("|----------|-----------|----------------|----------|------------|-----------------|--------------|\n");
+
+	for (int N = 2000; N <= largest; N *= 10)
+	{
+		// Same density as the N = 2000, scale 1 scene of main()
+		srand(12345);
+		const float scale = cbrtf(N / 2000.f);
+		vector<Object *> objects;
+		randomScene(objects, N, scale);
+
+		const char *names[3] = {"Midpoint", "LBVH-30", "LBVH-63"};
+		double buildTime[3];
+		vector<float> reference;
+		for (int b = 0; b < 3; ++b)
+		{
+			BVHBuildOptions options;
+			options.logStats = false;
+			if (b > 0)
+			{
+				options.splitMethod = SplitMorton;
+				options.mortonBits = b == 1 ? 30 : 63;
+				options.pool = &pool;
+			}
+
+			// Every builder starts from the same primitive order
+			vector<Object *> prims(objects);
+			Stopwatch sw;
+			BVH bvh(&prims, options);
+			buildTime[b] = sw.read();
+
+			vector<float> pixels(size * size * 3);
+			sw.reset();
+			renderImage(bvh, camera, pixels.data(), pool);
+			double renderTime = sw.read();
+
+			int diff = 0;
+			if (b == 0)
+				reference.swap(pixels);
+			else
+				for (size_t p = 0; p < pixels.size(); p += 3)
+					diff += pixels[p] != reference[p] || pixels[p + 1] != reference[p + 1] || pixels[p + 2] != reference[p + 2];
+
+			printf("| %8d | %-9s | %14.5f | %8.2f | %10.3f | %15.5f | %12d |\n", N, names[b], buildTime[b],
+				   buildTime[0] / buildTime[b], bvh.getSAHCost(), renderTime, diff);
+		}
+
+		for (Object *obj : objects)
+			delete obj;
+	}
+	return 0;
+}
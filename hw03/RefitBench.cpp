@@ -0,0 +1,94 @@
+// Benchmark: keeping the BVH of an animated scene up to date
+//   - Rebuild : a new BVH every frame
+//   - Refit   : BVH::refit() every frame, never rebuilding
+//   - Auto    : BVH::refit() with the default rebuild threshold on SAH cost growth
+// Every object drifts with its own constant velocity, the same in all three
+// runs. The table shows the average time to update the tree and to render a
+// 256x256 frame, the SAH cost after the last frame and the number of rebuilds.
+//
+// Usage: RefitBench [N] [frames]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "BVH.h"
+#include "RandomScene.h"
+#include "Renderer.h"
+#include "Stopwatch.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+	const int N = argc > 1 ? atoi(argv[1]) : 2000;
+	const int frames = argc > 2 ? atoi(argv[2]) : 60;
+	const int size = 256;
+
+	ThreadPool pool(1);
+	Camera camera(Vector3(1.6, 1.3, 1.6), Vector3(0, 0, 0), Vector3(0, 1, 0), size, size);
+	vector<float> pixels(size * size * 3);
+
+	printf("%d objects, %d frames, %dx%d renders\n", N, frames, size, size);
+	printf("| %-8s | %-16s | %-16s | %-14s | %-14s | %-8s |\n", "Update", "Update (ms/frm)", "Render (ms/frm)",
+		   "Built SAH", "Final SAH", "Rebuilds");
+	printf("|----------|------------------|------------------|----------------|----------------|----------|\n");
+
+	const char *names[3] = {"Rebuild", "Refit", "Auto"};
+	for (int strategy = 0; strategy < 3; ++strategy)
+	{
+		// The same scene and motion for every strategy
+		srand(12345);
+		vector<CompositeObject *> objects;
+		vector<Vector3> position, velocity;
+		for (int i = 0; i < N; ++i)
+		{
+			position.push_back(randVector3());
+			velocity.push_back(randVector3() * .005f);
+			objects.push_back(sceneObject(i, position.back()));
+		}
+		vector<Object *> prims(objects.begin(), objects.end());
+
+		BVHBuildOptions options;
+		options.logStats = false;
+		if (strategy == 1)
+			options.rebuildThreshold = 1e30f;
+		BVH *bvh = new BVH(&prims, options);
+		const float builtCost = bvh->getSAHCost();
+
+		double updateTime = 0, renderTime = 0;
+		int rebuilds = 0;
+		for (int f = 0; f < frames; ++f)
+		{
+			for (int i = 0; i < N; ++i)
+			{
+				position[i] = position[i] + velocity[i];
+				objects[i]->setTranslation(position[i]);
+			}
+
+			Stopwatch sw;
+			if (strategy == 0)
+			{
+				delete bvh;
+				bvh = new BVH(&prims, options);
+				rebuilds++;
+			}
+			else
+			{
+				rebuilds += bvh->refit();
+			}
+			updateTime += sw.read();
+
+			sw.reset();
+			renderImage(*bvh, camera, pixels.data(), pool);
+			renderTime += sw.read();
+		}
+
+		printf("| %-8s | %16.4f | %16.3f | %14.3f | %14.3f | %8d |\n", names[strategy], 1000 * updateTime / frames,
+			   1000 * renderTime / frames, builtCost, bvh->getSAHCost(), rebuilds);
+
+		delete bvh;
+		for (CompositeObject *obj : objects)
+			delete obj;
+	}
+	return 0;
+}
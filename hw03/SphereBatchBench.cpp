@@ -0,0 +1,99 @@
+// Microbenchmark: nearest-hit search over a cluster of spheres
+//   - Object path : std::vector<Sphere *>, one virtual getIntersection per sphere
+//   - Scalar      : SphereBatch::intersectScalar (SoA, one sphere at a time)
+//   - SIMD        : SphereBatch::intersect (SSE: 4, AVX: 8 spheres per instruction)
+// The 8-wide kernel needs -march=native or -mavx2.
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "RandomScene.h"
+#include "Sphere.h"
+#include "SphereBatch.h"
+#include "Stopwatch.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+	srand(12345);
+
+	const int nSpheres = argc > 1 ? atoi(argv[1]) : 96; // About one Doraemon
+	const int nRays = argc > 2 ? atoi(argv[2]) : 200000;
+
+	vector<Sphere *> parts;
+	SphereBatch batch;
+	for (int i = 0; i < nSpheres; ++i)
+	{
+		Vector3 c = randVector3();
+		float r = .05f + .1f * rand01();
+		parts.push_back(new Sphere(c, r));
+		batch.add(c, r);
+	}
+
+	vector<Ray> rays;
+	for (int i = 0; i < nRays; ++i)
+	{
+		Vector3 o = normalize(randVector3()) * 3.f;
+		rays.push_back(Ray(o, normalize(randVector3() * .5f - o)));
+	}
+
+#if defined(__AVX__)
+	const char *simd = "AVX (8-wide)";
+#elif defined(__SSE2__)
+	const char *simd = "SSE (4-wide)";
+#else
+	const char *simd = "none (scalar fallback)";
+#endif
+	printf("%d spheres, %d rays, SIMD kernel: %s\n", nSpheres, nRays, simd);
+
+	vector<float> tObject(nRays), tScalar(nRays), tSimd(nRays);
+
+	// Object path, as the composite objects used to do it
+	Stopwatch sw;
+	for (int i = 0; i < nRays; ++i)
+	{
+		IntersectionInfo I;
+		I.t = 999999999.f;
+		for (const Sphere *s : parts)
+			s->getIntersection(rays[i], &I);
+		tObject[i] = I.t;
+	}
+	double timeObject = sw.read();
+
+	sw.reset();
+	for (int i = 0; i < nRays; ++i)
+	{
+		float t = 999999999.f;
+		batch.intersectScalar(rays[i], 0, batch.size(), t, &t);
+		tScalar[i] = t;
+	}
+	double timeScalar = sw.read();
+
+	sw.reset();
+	for (int i = 0; i < nRays; ++i)
+	{
+		float t = 999999999.f;
+		batch.intersect(rays[i], 0, batch.size(), t, &t);
+		tSimd[i] = t;
+	}
+	double timeSimd = sw.read();
+
+	int mismatches = 0;
+	for (int i = 0; i < nRays; ++i)
+	{
+		if (fabs(tObject[i] - tSimd[i]) > 1e-4f * std::max(1.f, tObject[i]) || tObject[i] != tScalar[i])
+			mismatches++;
+	}
+
+	double tests = (double)nSpheres * nRays;
+	printf("| %-12s | %-12s | %-14s | %-8s |\n", "Path", "Time (s)", "ns / test", "Speedup");
+	printf("|--------------|--------------|----------------|----------|\n");
+	printf("| %-12s | %12.5f | %14.3f | %8.2f |\n", "Object", timeObject, 1e9 * timeObject / tests, 1.0);
+	printf("| %-12s | %12.5f | %14.3f | %8.2f |\n", "Scalar", timeScalar, 1e9 * timeScalar / tests, timeObject / timeScalar);
+	printf("| %-12s | %12.5f | %14.3f | %8.2f |\n", "SIMD", timeSimd, 1e9 * timeSimd / tests, timeObject / timeSimd);
+	printf("Mismatching nearest hits: %d\n", mismatches);
+
+	for (Sphere *s : parts)
+		delete s;
+	return mismatches != 0;
+}
@@ -7,8 +7,10 @@
 #include "Object.h"
 #include "IntersectionInfo.h"
 #include "Ray.h"
+#include "RayPacket.h"
 #include "Log.h"
 #include "Stopwatch.h"
+#include "ThreadPool.h"
 
 //+--------------------------------------------------------------------------------+
 //|                                Declaration                                     |
@@ -19,23 +21,117 @@ struct BVHFlatNode {
 	uint32_t start, nPrims, rightOffset;
 };
 
+//! Strategy used to choose the split of an interior node
+enum BVHSplitMethod {
+	SplitMidpoint, // Centroid midpoint of the longest axis
+	SplitSAH,      // Binned Surface Area Heuristic
+	SplitMorton    // Linear BVH: sorted Morton codes, split at the highest differing bit
+};
+
+//! Parameters controlling the BVH construction
+struct BVHBuildOptions {
+	BVHSplitMethod splitMethod;
+	uint32_t leafSize;      // Maximum number of primitives in a leaf
+	uint32_t sahBins;       // Number of centroid bins per axis (SplitSAH only)
+	float traversalCost;    // Relative cost of visiting an interior node (weights getSAHCost() only)
+	float intersectionCost; // Relative cost of one primitive intersection (weights getSAHCost() only)
+	bool logStats;          // Report build statistics (off for per-object trees)
+	uint32_t mortonBits;    // 30 (10 per axis) or 63 (21 per axis) bit codes (SplitMorton only)
+	ThreadPool *pool;       // Builds SplitMorton trees in parallel (NULL: on the calling thread)
+	float rebuildThreshold; // refit() rebuilds once the SAH cost exceeds this factor of the built tree's
+
+	explicit BVHBuildOptions(uint32_t leafSize = 4)
+			: splitMethod(SplitMidpoint), leafSize(leafSize), sahBins(16), traversalCost(1.f), intersectionCost(1.f),
+			  logStats(true), mortonBits(30), pool(NULL), rebuildThreshold(1.3f) {}
+};
+
+struct BVHMortonPrim;
+
 //! \author Brandon Pelfrey
 //! A Bounding Volume Hierarchy system for fast Ray-Object intersection tests
 class BVH {
-	uint32_t nNodes, nLeafs, leafSize;
+	uint32_t nNodes, nLeafs;
+	BVHBuildOptions options;
+	float sahCost, builtSAHCost;
 	std::vector<Object *> *build_prims;
 
 	//! Build the BVH tree out of build_prims
 	void build();
 
+	//! The SplitMorton builder (see the implementation)
+	void buildLinear();
+
+	//! Append the subtree over the Morton-sorted primitives [start, end) to nodes,
+	//! depth first with offsets relative to the subtree. Returns its bounds.
+	BBox emitLinear(const BVHMortonPrim *keys, uint32_t start, uint32_t end, std::vector<BVHFlatNode> &nodes,
+					uint32_t *leafs) const;
+
+	//! Split strategies, returning the partition point of [start, end)
+	uint32_t splitMidpoint(uint32_t start, uint32_t end, const BBox &bc);
+	uint32_t splitSAH(uint32_t start, uint32_t end, const BBox &bc);
+
+	//! Expected cost of a ray traversing the flat tree
+	float computeSAHCost() const;
+
+	//! traverse() of the subtree rooted at node root
+	bool traverseSubtree(uint32_t root, const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	template <typename LeafIntersector>
+	bool traverseSubtree(uint32_t root, const Ray &ray, IntersectionInfo *intersection, bool occlusion,
+						 const LeafIntersector &leaf) const;
+
 	// Fast Traversal System
 	BVHFlatNode *flatTree;
 
 public:
 	BVH(std::vector<Object *> *objects, uint32_t leafSize = 4);
 
+	BVH(std::vector<Object *> *objects, const BVHBuildOptions &options);
+
+	//! SAH cost of the tree as it is now, and as it was when last built
+	float getSAHCost() const { return sahCost; }
+
+	float getBuiltSAHCost() const { return builtSAHCost; }
+
+	//! Update the tree after the primitives moved, from their current getBBox()
+	//! - Node bounds are recomputed bottom-up in place: O(nodes), no allocation.
+	//!   The topology stays, so the tree degrades as objects drift apart.
+	//! - Once the SAH cost grows past options.rebuildThreshold times the cost of
+	//!   the last build, the tree is rebuilt from scratch instead
+	//! - Returns true if it rebuilt. Layouts derived from the tree (BVH4) are
+	//!   stale either way and must be collapsed again.
+	bool refit();
+
+	//! Read access to the flattened tree (used by derived layouts such as BVH4)
+	const BVHFlatNode *getFlatTree() const { return flatTree; }
+
+	uint32_t getNodeCount() const { return nNodes; }
+
+	//! Primitives, in the order the leaf ranges refer to
+	const std::vector<Object *> &getPrimitives() const { return *build_prims; }
+
 	bool getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
 
+	//! getIntersection() for every ray of a packet at once, intersections[i] for ray i.
+	//! Returns the mask of rays that hit something.
+	//! - Each node's box is tested against all active rays with one SIMD slab test,
+	//!   after a frustum test that may reject it for the whole packet
+	//! - Rays that miss a box drop out of the active mask for that subtree; once
+	//!   no more than RayPacketDivergent are left, they finish it one by one
+	uint32_t getIntersection(const RayPacket &packet, IntersectionInfo *intersections, bool occlusion) const;
+
+	//! Like getIntersection, but only looks for hits closer than intersection->t,
+	//! which the caller has set up (e.g. the closest hit of an enclosing tree).
+	//! intersection->hit is left untouched.
+	bool traverse(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	//! traverse() with a custom leaf test, for callers that keep the primitives
+	//! in their own layout (e.g. a SphereBatch in the same order as the leafs).
+	//! leaf(start, nPrims, intersection) must act like Object::getIntersection
+	//! over primitives [start, start + nPrims).
+	template <typename LeafIntersector>
+	bool traverse(const Ray &ray, IntersectionInfo *intersection, bool occlusion, const LeafIntersector &leaf) const;
+
 	~BVH();
 };
 
@@ -61,6 +157,41 @@ struct BVHTraversal {
 bool BVH::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
 	intersection->t = 999999999.f;
 	intersection->object = NULL;
+
+	traverse(ray, intersection, occlusion);
+
+	// If we hit something,
+	if (intersection->object != NULL)
+		intersection->hit = ray.o + ray.d * intersection->t;
+
+	return intersection->object != NULL;
+}
+
+bool BVH::traverse(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	return traverseSubtree(0, ray, intersection, occlusion);
+}
+
+template <typename LeafIntersector>
+bool BVH::traverse(const Ray &ray, IntersectionInfo *intersection, bool occlusion, const LeafIntersector &leaf) const {
+	return traverseSubtree(0, ray, intersection, occlusion, leaf);
+}
+
+bool BVH::traverseSubtree(uint32_t root, const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	return traverseSubtree(root, ray, intersection, occlusion,
+					[this, &ray](uint32_t start, uint32_t nPrims, IntersectionInfo *intersection) {
+						bool found = false;
+						for (uint32_t o = 0; o < nPrims; ++o)
+							found |= (*build_prims)[start + o]->getIntersection(ray, intersection);
+						return found;
+					});
+}
+
+//! Objects only report hits closer than intersection->t, so the bound set up
+//! by the caller culls both nodes and primitives.
+template <typename LeafIntersector>
+bool BVH::traverseSubtree(uint32_t root, const Ray &ray, IntersectionInfo *intersection, bool occlusion,
+						  const LeafIntersector &leaf) const {
+	bool found = false;
 	float bbhits[4];
 	int32_t closer, other;
 
@@ -69,7 +200,7 @@ bool BVH::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool o
 	int32_t stackptr = 0;
 
 	// "Push" on the root node to the working set
-	todo[stackptr].i = 0;
+	todo[stackptr].i = root;
 	todo[stackptr].mint = -9999999.f;
 
 	while (stackptr >= 0) {
@@ -85,14 +216,12 @@ bool BVH::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool o
 
 		// Is leaf -> Intersect
 		if (node.rightOffset == 0) {
-			for (uint32_t o = 0; o < node.nPrims; ++o) {
-				const Object *obj = (*build_prims)[node.start + o];
-				bool hit = obj->getIntersection(ray, intersection);
+			bool hit = leaf(node.start, node.nPrims, intersection);
+			found |= hit;
 
-				// If we're only looking for occlusion, then any hit is good enough
-				if (occlusion && hit) {
-					return true;
-				}
+			// If we're only looking for occlusion, then any hit is good enough
+			if (occlusion && hit) {
+				return true;
 			}
 
 		} else { // Not a leaf
@@ -131,11 +260,107 @@ bool BVH::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool o
 		}
 	}
 
-	// If we hit something,
-	if (intersection->object != NULL)
-		intersection->hit = ray.o + ray.d * intersection->t;
+	return found;
+}
 
-	return intersection->object != NULL;
+//! Stack entry of the packet traversal: a node and the rays still active in it
+struct BVHPacketTraversal {
+	uint32_t i;
+	uint32_t mask;
+};
+
+uint32_t BVH::getIntersection(const RayPacket &packet, IntersectionInfo *intersections, bool occlusion) const {
+	float tmax[RayPacketSize], tnear[RayPacketSize];
+	for (uint32_t r = 0; r < RayPacketSize; ++r) {
+		intersections[r].t = tmax[r] = 999999999.f;
+		intersections[r].object = NULL;
+	}
+
+	// Rays that are done (occlusion found) leave every mask
+	uint32_t live = packet.activeMask();
+	uint32_t found = 0;
+
+	// Working set
+	BVHPacketTraversal todo[64];
+	int32_t stackptr = 0;
+	todo[stackptr].i = 0;
+	todo[stackptr].mask = live;
+
+	while (stackptr >= 0) {
+		uint32_t ni = todo[stackptr].i;
+		uint32_t mask = todo[stackptr].mask & live;
+		stackptr--;
+		if (mask == 0)
+			continue;
+		const BVHFlatNode &node(flatTree[ni]);
+
+		// Frustum first: one scalar test may reject the box for every ray
+		float farthest = 0.f;
+		for (uint32_t m = mask; m; m &= m - 1)
+			farthest = std::max(farthest, tmax[firstLane(m)]);
+		if (packet.frustumMisses(node.bbox, farthest))
+			continue;
+
+		// Boxes are tested when popped, against the closest hits found so far
+		mask &= packet.intersect(node.bbox, tmax, tnear);
+		if (mask == 0)
+			continue;
+
+		// Diverged: the remaining rays finish this subtree on their own
+		if (countLanes(mask) <= RayPacketDivergent) {
+			for (uint32_t m = mask; m; m &= m - 1) {
+				uint32_t r = firstLane(m);
+				if (traverseSubtree(ni, packet.ray(r), intersections + r, occlusion)) {
+					found |= 1u << r;
+					tmax[r] = intersections[r].t;
+					if (occlusion)
+						live &= ~(1u << r);
+				}
+			}
+			continue;
+		}
+
+		// Is leaf -> Intersect every active ray
+		if (node.rightOffset == 0) {
+			for (uint32_t m = mask; m; m &= m - 1) {
+				uint32_t r = firstLane(m);
+				Ray ray = packet.ray(r);
+				bool hit = false;
+				for (uint32_t o = 0; o < node.nPrims && !(hit && occlusion); ++o)
+					hit |= (*build_prims)[node.start + o]->getIntersection(ray, intersections + r);
+				if (hit) {
+					found |= 1u << r;
+					tmax[r] = intersections[r].t;
+
+					// If we're only looking for occlusion, then any hit is good enough
+					if (occlusion)
+						live &= ~(1u << r);
+				}
+			}
+			continue;
+		}
+
+		// Visit the child nearer along the first active ray first (it is pushed last)
+		uint32_t closer = ni + 1, other = ni + node.rightOffset;
+		uint32_t r = firstLane(mask);
+		const BBox &b0 = flatTree[closer].bbox, &b1 = flatTree[other].bbox;
+		Vector3 toOther = (b1.min + b1.max) - (b0.min + b0.max);
+		if (toOther.x * packet.dx[r] + toOther.y * packet.dy[r] + toOther.z * packet.dz[r] < 0.f)
+			std::swap(closer, other);
+
+		todo[++stackptr].i = other;
+		todo[stackptr].mask = mask;
+		todo[++stackptr].i = closer;
+		todo[stackptr].mask = mask;
+	}
+
+	// Hit points of the rays that hit something
+	for (uint32_t m = found; m; m &= m - 1) {
+		uint32_t r = firstLane(m);
+		Ray ray = packet.ray(r);
+		intersections[r].hit = ray.o + ray.d * intersections[r].t;
+	}
+	return found;
 }
 
 BVH::~BVH() {
@@ -143,15 +368,52 @@ BVH::~BVH() {
 }
 
 BVH::BVH(std::vector<Object *> *objects, uint32_t leafSize)
-		: nNodes(0), nLeafs(0), leafSize(leafSize), build_prims(objects), flatTree(NULL) {
+		: BVH(objects, BVHBuildOptions(leafSize)) {}
+
+BVH::BVH(std::vector<Object *> *objects, const BVHBuildOptions &options)
+		: nNodes(0), nLeafs(0), options(options), sahCost(0.f), builtSAHCost(0.f), build_prims(objects), flatTree(NULL) {
 	Stopwatch sw;
 
 	// Build the tree based on the input object data set.
 	build();
+	sahCost = builtSAHCost = computeSAHCost();
 
 	// Output tree build time and statistics
 	double constructionTime = sw.read();
-	LOG_STAT("Built BVH (%d nodes, with %d leafs) in %d ms", nNodes, nLeafs, (int) (1000 * constructionTime));
+	if (this->options.logStats)
+		LOG_STAT("Built BVH (%d nodes, with %d leafs, SAH cost %.3f) in %d ms", nNodes, nLeafs, sahCost, (int) (1000 * constructionTime));
+}
+
+/*! Children follow their parent in the depth-first flat tree, so a backwards
+ *  sweep sees both children of a node before the node itself.
+ */
+bool BVH::refit() {
+	for (uint32_t n = nNodes; n-- > 0;) {
+		BVHFlatNode &node(flatTree[n]);
+		if (node.rightOffset == 0) {
+			node.bbox = (*build_prims)[node.start]->getBBox();
+			for (uint32_t p = 1; p < node.nPrims; ++p)
+				node.bbox.expandToInclude((*build_prims)[node.start + p]->getBBox());
+		} else {
+			node.bbox = flatTree[n + 1].bbox;
+			node.bbox.expandToInclude(flatTree[n + node.rightOffset].bbox);
+		}
+	}
+	sahCost = computeSAHCost();
+
+	if (!(sahCost > options.rebuildThreshold * builtSAHCost))
+		return false;
+
+	Stopwatch sw;
+	float degraded = sahCost;
+	delete[] flatTree;
+	flatTree = NULL;
+	nNodes = nLeafs = 0;
+	build();
+	sahCost = builtSAHCost = computeSAHCost();
+	if (options.logStats)
+		LOG_STAT("Rebuilt BVH (SAH cost %.3f after refit, %.3f rebuilt) in %d ms", degraded, sahCost, (int) (1000 * sw.read()));
+	return true;
 }
 
 struct BVHBuildEntry {
@@ -170,6 +432,11 @@ struct BVHBuildEntry {
  *  - The partition here was also slightly faster than std::partition.
  */
 void BVH::build() {
+	if (options.splitMethod == SplitMorton) {
+		buildLinear();
+		return;
+	}
+
 	BVHBuildEntry todo[128];
 	uint32_t stackptr = 0;
 	const uint32_t Untouched = 0xffffffff;
@@ -208,7 +475,7 @@ void BVH::build() {
 
 		// If the number of primitives at this point is less than the leaf
 		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nPrims <= leafSize) {
+		if (nPrims <= options.leafSize) {
 			node.rightOffset = 0;
 			nLeafs++;
 		}
@@ -231,20 +498,12 @@ void BVH::build() {
 		if (node.rightOffset == 0)
 			continue;
 
-		// Set the split dimensions
-		uint32_t split_dim = bc.maxDimension();
-
-		// Split on the center of the longest axis
-		float split_coord = .5f * (bc.min[split_dim] + bc.max[split_dim]);
-
-		// Partition the list of objects on this split
-		uint32_t mid = start;
-		for (uint32_t i = start; i < end; ++i) {
-			if ((*build_prims)[i]->getCentroid()[split_dim] < split_coord) {
-				std::swap((*build_prims)[i], (*build_prims)[mid]);
-				++mid;
-			}
-		}
+		// Choose the split according to the build options
+		uint32_t mid;
+		if (options.splitMethod == SplitSAH)
+			mid = splitSAH(start, end, bc);
+		else
+			mid = splitMidpoint(start, end, bc);
 
 		// If we get a bad split, just choose the center...
 		if (mid == start || mid == end) {
@@ -272,6 +531,428 @@ void BVH::build() {
 		flatTree[n] = buildnodes[n];
 }
 
+//! Split on the center of the longest axis of the centroid bounds
+uint32_t BVH::splitMidpoint(uint32_t start, uint32_t end, const BBox &bc) {
+	// Set the split dimensions
+	uint32_t split_dim = bc.maxDimension();
+
+	// Split on the center of the longest axis
+	float split_coord = .5f * (bc.min[split_dim] + bc.max[split_dim]);
+
+	// Partition the list of objects on this split
+	uint32_t mid = start;
+	for (uint32_t i = start; i < end; ++i) {
+		if ((*build_prims)[i]->getCentroid()[split_dim] < split_coord) {
+			std::swap((*build_prims)[i], (*build_prims)[mid]);
+			++mid;
+		}
+	}
+	return mid;
+}
+
+//! One bucket of the binned SAH sweep
+struct BVHSAHBin {
+	BBox bbox;
+	uint32_t count;
+};
+
+/*! Binned Surface Area Heuristic split
+ *  - Centroids are projected into sahBins equal-width bins on each axis, and
+ *    every bin boundary is evaluated as a candidate plane.
+ *  - Planes are ranked by N_L * SA(L) + N_R * SA(R). The full SAH cost
+ *    Ct + Ci * (...) / SA(node) has the same minimum, so traversalCost and
+ *    intersectionCost play no part here; there is no SAH termination either,
+ *    every node above leafSize is split.
+ *  - Returns start (a bad split) when no plane separates the centroids, so
+ *    the caller falls back to the median.
+ */
+uint32_t BVH::splitSAH(uint32_t start, uint32_t end, const BBox &bc) {
+	const uint32_t MaxBins = 64;
+	const uint32_t nBins = std::max(2u, std::min(options.sahBins, MaxBins));
+	BVHSAHBin bins[MaxBins];
+	float rightArea[MaxBins];
+	uint32_t rightCount[MaxBins];
+
+	float bestCost = 1e30f;
+	uint32_t bestDim = 0, bestBin = 0;
+
+	for (uint32_t dim = 0; dim < 3; ++dim) {
+		float extent = bc.extent[dim];
+		if (!(extent > 0.f))
+			continue;
+		float k = nBins * (1.f - 1e-4f) / extent;
+
+		// Drop every centroid into its bin
+		for (uint32_t b = 0; b < nBins; ++b)
+			bins[b].count = 0;
+		for (uint32_t i = start; i < end; ++i) {
+			const Object *obj = (*build_prims)[i];
+			uint32_t b = std::min(nBins - 1, (uint32_t) (k * (obj->getCentroid()[dim] - bc.min[dim])));
+			if (bins[b].count++ == 0)
+				bins[b].bbox = obj->getBBox();
+			else
+				bins[b].bbox.expandToInclude(obj->getBBox());
+		}
+
+		// Sweep from the right, recording the area and count of everything right of each plane
+		BBox acc;
+		uint32_t count = 0;
+		for (uint32_t b = nBins - 1; b > 0; --b) {
+			if (bins[b].count) {
+				if (count == 0)
+					acc = bins[b].bbox;
+				else
+					acc.expandToInclude(bins[b].bbox);
+				count += bins[b].count;
+			}
+			rightCount[b] = count;
+			rightArea[b] = count ? acc.surfaceArea() : 0.f;
+		}
+
+		// Sweep from the left and evaluate the plane in front of bin b
+		count = 0;
+		for (uint32_t b = 1; b < nBins; ++b) {
+			if (bins[b - 1].count) {
+				if (count == 0)
+					acc = bins[b - 1].bbox;
+				else
+					acc.expandToInclude(bins[b - 1].bbox);
+				count += bins[b - 1].count;
+			}
+			if (count == 0 || rightCount[b] == 0)
+				continue;
+
+			float cost = count * acc.surfaceArea() + rightCount[b] * rightArea[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestDim = dim;
+				bestBin = b;
+			}
+		}
+	}
+
+	// All centroids coincide: nothing to separate
+	if (bestBin == 0)
+		return start;
+
+	// Partition the list of objects on the winning plane
+	float k = nBins * (1.f - 1e-4f) / bc.extent[bestDim];
+	uint32_t mid = start;
+	for (uint32_t i = start; i < end; ++i) {
+		uint32_t b = std::min(nBins - 1, (uint32_t) (k * ((*build_prims)[i]->getCentroid()[bestDim] - bc.min[bestDim])));
+		if (b < bestBin) {
+			std::swap((*build_prims)[i], (*build_prims)[mid]);
+			++mid;
+		}
+	}
+	return mid;
+}
+
+//! Morton code of a primitive's centroid and the primitive's index in build_prims
+struct BVHMortonPrim {
+	uint64_t code;
+	uint32_t index;
+};
+
+//! Spread the lower 10 bits of v two zero bits apart
+static uint64_t mortonExpand10(uint64_t v) {
+	v &= 0x3ff;
+	v = (v | v << 16) & 0x30000ff;
+	v = (v | v << 8) & 0x300f00f;
+	v = (v | v << 4) & 0x30c30c3;
+	v = (v | v << 2) & 0x9249249;
+	return v;
+}
+
+//! Spread the lower 21 bits of v two zero bits apart
+static uint64_t mortonExpand21(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+//! Chunks to cut count items into: a few per pool participant, none below grain items
+static uint32_t bvhChunks(ThreadPool *pool, uint32_t count, uint32_t grain = 4096) {
+	if (!pool || pool->size() < 2)
+		return 1;
+	return std::max(1u, std::min(4 * pool->size(), count / grain));
+}
+
+//! body(chunk, begin, end) for nChunks equal chunks of [0, count), on the pool
+template <typename Body>
+static void bvhParallelFor(ThreadPool *pool, uint32_t count, uint32_t nChunks, const Body &body) {
+	if (nChunks <= 1) {
+		body(0u, 0u, count);
+		return;
+	}
+	for (uint32_t c = 0; c < nChunks; ++c) {
+		uint32_t begin = (uint32_t) ((uint64_t) count * c / nChunks);
+		uint32_t end = (uint32_t) ((uint64_t) count * (c + 1) / nChunks);
+		pool->submit([&body, c, begin, end] { body(c, begin, end); });
+	}
+	pool->wait();
+}
+
+/*! Stable LSD radix sort of the keys on the low bits of their codes, 8 bits a pass
+ *  - Every chunk counts its digits, then scatters to the slots given by a
+ *    digit-major, chunk-minor prefix sum, so equal digits keep their order
+ *  - Passes where every key has the same digit are skipped
+ */
+static void bvhRadixSort(ThreadPool *pool, std::vector<BVHMortonPrim> &keys, uint32_t bits) {
+	const uint32_t n = (uint32_t) keys.size();
+	const uint32_t nChunks = bvhChunks(pool, n);
+	std::vector<BVHMortonPrim> sorted(n);
+	std::vector<uint32_t> slots(nChunks * 256);
+
+	for (uint32_t shift = 0; shift < bits; shift += 8) {
+		bvhParallelFor(pool, n, nChunks, [&](uint32_t c, uint32_t begin, uint32_t end) {
+			uint32_t *count = &slots[c * 256];
+			std::fill(count, count + 256, 0u);
+			for (uint32_t i = begin; i < end; ++i)
+				count[(keys[i].code >> shift) & 255]++;
+		});
+
+		bool trivial = false;
+		uint32_t sum = 0;
+		for (uint32_t d = 0; d < 256; ++d) {
+			uint32_t first = sum;
+			for (uint32_t c = 0; c < nChunks; ++c) {
+				uint32_t count = slots[c * 256 + d];
+				slots[c * 256 + d] = sum;
+				sum += count;
+			}
+			trivial |= sum - first == n;
+		}
+		if (trivial)
+			continue;
+
+		bvhParallelFor(pool, n, nChunks, [&](uint32_t c, uint32_t begin, uint32_t end) {
+			uint32_t *slot = &slots[c * 256];
+			for (uint32_t i = begin; i < end; ++i)
+				sorted[slot[(keys[i].code >> shift) & 255]++] = keys[i];
+		});
+		keys.swap(sorted);
+	}
+}
+
+//! Split [start, end) of sorted keys where the highest bit that differs
+//! between the first and the last code turns on (the middle for equal codes)
+static uint32_t linearSplit(const BVHMortonPrim *keys, uint32_t start, uint32_t end) {
+	uint64_t diff = keys[start].code ^ keys[end - 1].code;
+	if (diff == 0)
+		return start + (end - start) / 2;
+	while (diff & (diff - 1))
+		diff &= diff - 1;
+
+	// All codes of the range agree above that bit, so it is sorted by it
+	uint32_t lo = start + 1, hi = end - 1;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (keys[mid].code & diff)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+BBox BVH::emitLinear(const BVHMortonPrim *keys, uint32_t start, uint32_t end, std::vector<BVHFlatNode> &nodes,
+					 uint32_t *leafs) const {
+	// nodes may reallocate, so don't hold on to a reference
+	uint32_t index = (uint32_t) nodes.size();
+	nodes.push_back(BVHFlatNode());
+	nodes[index].start = start;
+	nodes[index].nPrims = end - start;
+
+	BBox bb;
+	if (end - start <= options.leafSize) {
+		bb = (*build_prims)[start]->getBBox();
+		for (uint32_t p = start + 1; p < end; ++p)
+			bb.expandToInclude((*build_prims)[p]->getBBox());
+		nodes[index].rightOffset = 0;
+		++*leafs;
+	} else {
+		uint32_t mid = linearSplit(keys, start, end);
+		bb = emitLinear(keys, start, mid, nodes, leafs);
+		nodes[index].rightOffset = (uint32_t) nodes.size() - index;
+		bb.expandToInclude(emitLinear(keys, mid, end, nodes, leafs));
+	}
+	nodes[index].bbox = bb;
+	return bb;
+}
+
+//! Node of the top levels of a parallel linear build: either split on the
+//! calling thread (left/right index other tops) or handed to a task
+struct BVHLinearTop {
+	uint32_t start, end;
+	int32_t left, right, task;
+	uint32_t offset; // Position in the flat tree
+};
+
+//! A subtree of the linear build, emitted by one task
+struct BVHLinearTask {
+	uint32_t start, end, leafs, offset;
+	std::vector<BVHFlatNode> nodes;
+};
+
+/*! Linear BVH (Lauterbach et al.): the tree follows the bits of the sorted
+ *  Morton codes of the centroids, so building it is a sort plus a linear pass
+ *  - Centroid bounds, codes (options.mortonBits, interleaved per axis), the
+ *    radix sort and the reordering of build_prims run in chunks on options.pool
+ *  - The top levels are split on this thread until every range is small
+ *    enough for one task; tasks emit their subtrees in parallel, each with
+ *    offsets relative to its own root, so they are copied into place as is
+ *  - The result is the same flat, depth-first tree the other builders emit
+ */
+void BVH::buildLinear() {
+	ThreadPool *pool = options.pool;
+	const uint32_t n = (uint32_t) build_prims->size();
+	const uint32_t nChunks = bvhChunks(pool, n);
+
+	// Bounds of the centroids, one partial box per chunk
+	std::vector<BBox> partial(nChunks);
+	bvhParallelFor(pool, n, nChunks, [&](uint32_t c, uint32_t begin, uint32_t end) {
+		BBox bc((*build_prims)[begin]->getCentroid());
+		for (uint32_t i = begin + 1; i < end; ++i)
+			bc.expandToInclude((*build_prims)[i]->getCentroid());
+		partial[c] = bc;
+	});
+	BBox bc = partial[0];
+	for (uint32_t c = 1; c < nChunks; ++c)
+		bc.expandToInclude(partial[c]);
+
+	// Quantize each centroid to the grid and interleave the axes
+	const bool wide = options.mortonBits > 30;
+	const float cells = wide ? 2097151.f : 1023.f;
+	Vector3 scale;
+	for (uint32_t a = 0; a < 3; ++a)
+		scale[a] = bc.extent[a] > 0.f ? cells / bc.extent[a] : 0.f;
+
+	std::vector<BVHMortonPrim> keys(n);
+	bvhParallelFor(pool, n, nChunks, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			Vector3 q = (*build_prims)[i]->getCentroid() - bc.min;
+			uint64_t x = (uint64_t) std::min(cells, q.x * scale.x);
+			uint64_t y = (uint64_t) std::min(cells, q.y * scale.y);
+			uint64_t z = (uint64_t) std::min(cells, q.z * scale.z);
+			keys[i].code = wide ? mortonExpand21(x) << 2 | mortonExpand21(y) << 1 | mortonExpand21(z)
+								: mortonExpand10(x) << 2 | mortonExpand10(y) << 1 | mortonExpand10(z);
+			keys[i].index = i;
+		}
+	});
+	bvhRadixSort(pool, keys, wide ? 63 : 30);
+
+	// Leaf ranges refer to build_prims, so put it in Morton order
+	std::vector<Object *> sorted(n);
+	bvhParallelFor(pool, n, nChunks, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i)
+			sorted[i] = (*build_prims)[keys[i].index];
+	});
+	build_prims->swap(sorted);
+
+	// Split the top levels until the ranges are a fraction of a participant's share
+	const uint32_t taskSize = std::max(options.leafSize, n / (nChunks > 1 ? 4 * pool->size() : 1));
+	std::vector<BVHLinearTop> tops;
+	std::vector<BVHLinearTask> tasks;
+	std::vector<uint32_t> open(1, 0);
+	tops.push_back({0, n, -1, -1, -1, 0});
+	while (!open.empty()) {
+		uint32_t t = open.back();
+		open.pop_back();
+		uint32_t start = tops[t].start, end = tops[t].end;
+		if (end - start <= taskSize) {
+			tops[t].task = (int32_t) tasks.size();
+			tasks.push_back(BVHLinearTask());
+			tasks.back().start = start;
+			tasks.back().end = end;
+			tasks.back().leafs = 0;
+			continue;
+		}
+		uint32_t mid = linearSplit(keys.data(), start, end);
+		tops[t].left = (int32_t) tops.size();
+		tops.push_back({start, mid, -1, -1, -1, 0});
+		tops[t].right = (int32_t) tops.size();
+		tops.push_back({mid, end, -1, -1, -1, 0});
+		open.push_back(tops[t].right);
+		open.push_back(tops[t].left);
+	}
+
+	bvhParallelFor(pool, (uint32_t) tasks.size(), (uint32_t) tasks.size(), [&](uint32_t t, uint32_t, uint32_t) {
+		BVHLinearTask &task(tasks[t]);
+		task.nodes.reserve(2 * (task.end - task.start) / std::max(1u, options.leafSize) + 1);
+		emitLinear(keys.data(), task.start, task.end, task.nodes, &task.leafs);
+	});
+
+	// Lay the tops and subtrees out depth first: a top, its left side, its right side
+	nNodes = 0;
+	nLeafs = 0;
+	std::vector<std::pair<uint32_t, bool> > walk(1, std::make_pair(0u, false));
+	while (!walk.empty()) {
+		uint32_t t = walk.back().first;
+		bool second = walk.back().second;
+		walk.pop_back();
+		BVHLinearTop &top(tops[t]);
+		if (top.task >= 0) {
+			tasks[top.task].offset = top.offset = nNodes;
+			nNodes += (uint32_t) tasks[top.task].nodes.size();
+			nLeafs += tasks[top.task].leafs;
+		} else if (!second) {
+			// Revisit after the left side to record where the right one starts
+			top.offset = nNodes++;
+			walk.push_back(std::make_pair(t, true));
+			walk.push_back(std::make_pair((uint32_t) top.left, false));
+		} else {
+			walk.push_back(std::make_pair((uint32_t) top.right, false));
+		}
+	}
+
+	flatTree = new BVHFlatNode[nNodes];
+	bvhParallelFor(pool, (uint32_t) tasks.size(), (uint32_t) tasks.size(), [&](uint32_t t, uint32_t, uint32_t) {
+		std::copy(tasks[t].nodes.begin(), tasks[t].nodes.end(), flatTree + tasks[t].offset);
+	});
+
+	// Tops come after their parent in tops, so going backwards sees the children first
+	for (uint32_t t = (uint32_t) tops.size(); t-- > 0;) {
+		const BVHLinearTop &top(tops[t]);
+		if (top.task >= 0)
+			continue;
+		BVHFlatNode &node(flatTree[top.offset]);
+		node.start = top.start;
+		node.nPrims = top.end - top.start;
+		node.rightOffset = tops[top.right].offset - top.offset;
+		node.bbox = flatTree[tops[top.left].offset].bbox;
+		node.bbox.expandToInclude(flatTree[tops[top.right].offset].bbox);
+	}
+}
+
+/*! SAH cost of the finished tree, relative to the root surface area
+ *  - Interior nodes contribute traversalCost, leafs intersectionCost per
+ *    primitive, each weighted by the probability SA(node) / SA(root) of a
+ *    random ray hitting the node.
+ */
+float BVH::computeSAHCost() const {
+	if (nNodes == 0)
+		return 0.f;
+	float rootArea = flatTree[0].bbox.surfaceArea();
+	if (!(rootArea > 0.f))
+		return 0.f;
+
+	float cost = 0.f;
+	for (uint32_t n = 0; n < nNodes; ++n) {
+		const BVHFlatNode &node(flatTree[n]);
+		float p = node.bbox.surfaceArea() / rootArea;
+		if (node.rightOffset == 0)
+			cost += p * options.intersectionCost * node.nPrims;
+		else
+			cost += p * options.traversalCost;
+	}
+	return cost;
+}
+
 
 
 #endif
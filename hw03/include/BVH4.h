@@ -0,0 +1,283 @@
+#ifndef BVH4_h
+#define BVH4_h
+
+#include <vector>
+#include <stdint.h>
+#include "BVH.h"
+#include "Object.h"
+#include "IntersectionInfo.h"
+#include "Ray.h"
+#include "Log.h"
+#include "Stopwatch.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Node of the 4-wide tree: the boxes of all four children in SoA form
+//! - bounds[axis][0][c] is the min and bounds[axis][1][c] the max of child c,
+//!   so one axis of all four children is a single 8-float (or two 4-float) load.
+//! - A child with count > 0 is a leaf covering primitives [child, child + count),
+//!   otherwise child is the index of a BVH4Node. Unused slots hold
+//!   BVH4EmptySlot and are masked out after the slab test.
+struct alignas(32) BVH4Node {
+	float bounds[3][2][4];
+	uint32_t child[4];
+	uint32_t count[4];
+};
+
+const uint32_t BVH4EmptySlot = 0xffffffff;
+
+//! A 4-ary BVH obtained by collapsing the binary BVH, traversed with one SIMD
+//! slab test per node
+class BVH4 {
+	std::vector<BVH4Node> nodes;
+	const std::vector<Object *> *prims;
+	uint32_t nLeafs;
+
+	//! Collapse the binary subtree rooted at interior node ni into nodes[index]
+	void collapse(const BVHFlatNode *flatTree, uint32_t ni, uint32_t index);
+
+	//! Slab test of the ray against the four children of node.
+	//! Writes the entry distances and returns a 4-bit mask of the children hit closer than tmax.
+	static uint32_t intersectChildren(const BVH4Node &node, const Ray &ray, float tmax, float tnear[4]);
+
+public:
+	explicit BVH4(const BVH &bvh);
+
+	bool getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	uint32_t getNodeCount() const { return (uint32_t) nodes.size(); }
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+BVH4::BVH4(const BVH &bvh)
+		: prims(&bvh.getPrimitives()), nLeafs(0) {
+	Stopwatch sw;
+	const BVHFlatNode *flatTree = bvh.getFlatTree();
+
+	nodes.reserve(bvh.getNodeCount() / 2 + 1);
+	nodes.push_back(BVH4Node());
+
+	if (flatTree[0].rightOffset == 0) {
+		// The whole tree is one leaf: give the root a single leaf child
+		BVH4Node &root(nodes[0]);
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t a = 0; a < 3; ++a) {
+				root.bounds[a][0][c] = c == 0 ? flatTree[0].bbox.min[a] : 0.f;
+				root.bounds[a][1][c] = c == 0 ? flatTree[0].bbox.max[a] : 0.f;
+			}
+			root.child[c] = c == 0 ? flatTree[0].start : BVH4EmptySlot;
+			root.count[c] = c == 0 ? flatTree[0].nPrims : 0;
+		}
+		nLeafs = 1;
+	} else {
+		collapse(flatTree, 0, 0);
+	}
+
+	LOG_STAT("Collapsed BVH4 (%d nodes, with %d leafs) in %d ms", (int) nodes.size(), nLeafs, (int) (1000 * sw.read()));
+}
+
+/*! Pull up to four descendants of a binary node into one BVH4 node
+ *  - Starting from the two children, the interior child with the largest
+ *    surface area is repeatedly replaced by its own two children.
+ *  - Whatever remains interior is collapsed recursively.
+ */
+void BVH4::collapse(const BVHFlatNode *flatTree, uint32_t ni, uint32_t index) {
+	uint32_t open[4] = {ni + 1, ni + flatTree[ni].rightOffset, 0, 0};
+	uint32_t nOpen = 2;
+
+	while (nOpen < 4) {
+		int32_t best = -1;
+		float bestArea = -1.f;
+		for (uint32_t c = 0; c < nOpen; ++c) {
+			const BVHFlatNode &n(flatTree[open[c]]);
+			if (n.rightOffset != 0 && n.bbox.surfaceArea() > bestArea) {
+				bestArea = n.bbox.surfaceArea();
+				best = c;
+			}
+		}
+		if (best < 0)
+			break;
+
+		uint32_t b = open[best];
+		open[best] = b + 1;
+		open[nOpen++] = b + flatTree[b].rightOffset;
+	}
+
+	for (uint32_t c = 0; c < 4; ++c) {
+		BVH4Node &node(nodes[index]);
+		if (c >= nOpen) {
+			for (uint32_t a = 0; a < 3; ++a)
+				node.bounds[a][0][c] = node.bounds[a][1][c] = 0.f;
+			node.child[c] = BVH4EmptySlot;
+			node.count[c] = 0;
+			continue;
+		}
+
+		const BVHFlatNode &fn(flatTree[open[c]]);
+		for (uint32_t a = 0; a < 3; ++a) {
+			node.bounds[a][0][c] = fn.bbox.min[a];
+			node.bounds[a][1][c] = fn.bbox.max[a];
+		}
+
+		if (fn.rightOffset == 0) {
+			node.child[c] = fn.start;
+			node.count[c] = fn.nPrims;
+			nLeafs++;
+		} else {
+			// nodes may reallocate, so don't hold on to the reference
+			uint32_t childIndex = (uint32_t) nodes.size();
+			node.child[c] = childIndex;
+			node.count[c] = 0;
+			nodes.push_back(BVH4Node());
+			collapse(flatTree, open[c], childIndex);
+		}
+	}
+}
+
+uint32_t BVH4::intersectChildren(const BVH4Node &node, const Ray &ray, float tmax, float tnear[4]) {
+#if defined(__AVX__)
+	// One 8-wide operation per axis handles the min and max planes of all children
+	__m256 ta[3];
+	for (uint32_t a = 0; a < 3; ++a) {
+		__m256 b = _mm256_load_ps(node.bounds[a][0]);
+		ta[a] = _mm256_mul_ps(_mm256_sub_ps(b, _mm256_set1_ps(ray.o[a])), _mm256_set1_ps(ray.inv_d[a]));
+	}
+	// Swap the min/max halves to get the far plane alongside each near plane
+	for (uint32_t a = 0; a < 3; ++a) {
+		__m256 swapped = _mm256_permute2f128_ps(ta[a], ta[a], 0x01);
+		__m256 tlo = _mm256_min_ps(ta[a], swapped);
+		__m256 thi = _mm256_max_ps(ta[a], swapped);
+		ta[a] = _mm256_blend_ps(tlo, thi, 0xf0);
+	}
+	__m256 tn = _mm256_max_ps(_mm256_max_ps(ta[0], ta[1]), ta[2]);
+	__m256 tf = _mm256_min_ps(_mm256_min_ps(ta[0], ta[1]), ta[2]);
+	__m128 tnear4 = _mm256_castps256_ps128(tn);
+	__m128 tfar4 = _mm256_extractf128_ps(tf, 1);
+#elif defined(__SSE__) || defined(_M_X64)
+	__m128 tnear4 = _mm_set1_ps(-1e30f);
+	__m128 tfar4 = _mm_set1_ps(1e30f);
+	for (uint32_t a = 0; a < 3; ++a) {
+		__m128 o = _mm_set1_ps(ray.o[a]);
+		__m128 inv = _mm_set1_ps(ray.inv_d[a]);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a][0]), o), inv);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a][1]), o), inv);
+		tnear4 = _mm_max_ps(tnear4, _mm_min_ps(t0, t1));
+		tfar4 = _mm_min_ps(tfar4, _mm_max_ps(t0, t1));
+	}
+#endif
+
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64)
+	// Same acceptance as BBox::intersect, plus culling against the closest hit
+	__m128 hit = _mm_and_ps(_mm_cmpngt_ps(tnear4, tfar4), _mm_cmpgt_ps(tfar4, _mm_setzero_ps()));
+	hit = _mm_and_ps(hit, _mm_cmpngt_ps(tnear4, _mm_set1_ps(tmax)));
+	_mm_storeu_ps(tnear, tnear4);
+	uint32_t mask = (uint32_t) _mm_movemask_ps(hit);
+#else
+	uint32_t mask = 0;
+	for (uint32_t c = 0; c < 4; ++c) {
+		float tn = -1e30f, tf = 1e30f;
+		for (uint32_t a = 0; a < 3; ++a) {
+			float t0 = (node.bounds[a][0][c] - ray.o[a]) * ray.inv_d[a];
+			float t1 = (node.bounds[a][1][c] - ray.o[a]) * ray.inv_d[a];
+			tn = std::max(tn, std::min(t0, t1));
+			tf = std::min(tf, std::max(t0, t1));
+		}
+		tnear[c] = tn;
+		if (!(tn > tf) && tf > 0 && !(tn > tmax))
+			mask |= 1u << c;
+	}
+#endif
+
+	for (uint32_t c = 0; c < 4; ++c) {
+		if (node.child[c] == BVH4EmptySlot)
+			mask &= ~(1u << c);
+	}
+	return mask;
+}
+
+//! Stack entry of the BVH4 traversal: a node or a leaf range, and its entry distance
+struct BVH4Traversal {
+	uint32_t child, count;
+	float mint;
+};
+
+bool BVH4::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	intersection->t = 999999999.f;
+	intersection->object = NULL;
+	float tnear[4];
+
+	// Working set (up to three entries are left behind per level)
+	BVH4Traversal todo[128];
+	int32_t stackptr = 0;
+
+	todo[stackptr].child = 0;
+	todo[stackptr].count = 0;
+	todo[stackptr].mint = -9999999.f;
+
+	while (stackptr >= 0) {
+		BVH4Traversal entry = todo[stackptr--];
+
+		// If this node is further than the closest found intersection, continue
+		if (entry.mint > intersection->t)
+			continue;
+
+		// Leaf range -> Intersect
+		if (entry.count > 0) {
+			for (uint32_t o = 0; o < entry.count; ++o) {
+				const Object *obj = (*prims)[entry.child + o];
+				bool hit = obj->getIntersection(ray, intersection);
+
+				// If we're only looking for occlusion, then any hit is good enough
+				if (occlusion && hit) {
+					return true;
+				}
+			}
+			continue;
+		}
+
+		const BVH4Node &node(nodes[entry.child]);
+		uint32_t mask = intersectChildren(node, ray, intersection->t, tnear);
+		if (mask == 0)
+			continue;
+
+		// Order the hit children from far to near, so the nearest is popped first
+		uint32_t order[4];
+		uint32_t nHit = 0;
+		for (uint32_t c = 0; c < 4; ++c) {
+			if (!(mask & (1u << c)))
+				continue;
+			uint32_t k = nHit++;
+			while (k > 0 && tnear[order[k - 1]] < tnear[c]) {
+				order[k] = order[k - 1];
+				--k;
+			}
+			order[k] = c;
+		}
+
+		for (uint32_t k = 0; k < nHit; ++k) {
+			uint32_t c = order[k];
+			BVH4Traversal &t(todo[++stackptr]);
+			t.child = node.child[c];
+			t.count = node.count[c];
+			t.mint = tnear[c];
+		}
+	}
+
+	// If we hit something,
+	if (intersection->object != NULL)
+		intersection->hit = ray.o + ray.d * intersection->t;
+
+	return intersection->object != NULL;
+}
+
+#endif
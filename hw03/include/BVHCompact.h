@@ -0,0 +1,382 @@
+#ifndef BVHCompact_h
+#define BVHCompact_h
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <stdint.h>
+#include "BVH.h"
+#include "Object.h"
+#include "IntersectionInfo.h"
+#include "Ray.h"
+#include "Log.h"
+#include "Stopwatch.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Node layouts of BVHCompact
+enum BVHNodeFormat {
+	BVHNodeFloat,   // 32 bytes: float bounds without BBox's extent, link and count
+	BVHNodeQuant16, // 16 bytes: bounds quantized to 16 bits within the parent's
+	BVHNodeQuant8   // 12 bytes: bounds quantized to 8 bits within the parent's
+};
+
+const char *nodeFormatName(BVHNodeFormat format);
+
+//! Bounds without the redundant extent of BBox
+struct BVHBounds {
+	Vector3 min, max;
+};
+
+//! Full-precision node: half a cache line instead of BVHFlatNode's 48 bytes.
+//! link is the first primitive of a leaf (count > 0) or the right child's
+//! offset of an interior node (count == 0); the left child follows the node.
+struct BVHNodeFloat32 {
+	static const bool quantized = false;
+	BVHBounds bounds;
+	uint32_t link, count;
+};
+
+//! The BVHFlatNode as a BVHNodeFloat32
+inline BVHNodeFloat32 compactNode(const BVHFlatNode &node);
+
+//! Quantized node: the node's box on a grid of numeric_limits<Q>::max() steps
+//! per axis across its parent's decoded box. q[0..2] count steps up from the
+//! parent's min, q[3..5] steps down from its max, so the extreme values decode
+//! exactly to the parent's planes.
+//! - link holds the right child's offset of an interior node, or
+//!   start | count << BVHQuantCountShift for a leaf
+template <typename Q>
+struct BVHNodeQuant {
+	static const bool quantized = true;
+	Q q[6];
+	uint32_t link;
+};
+
+//! Leaf encoding of quantized nodes: up to 31 primitives, starting below 2^27
+const uint32_t BVHQuantCountShift = 27;
+
+//! The binary BVH re-encoded into a compact node layout, so more of the top
+//! levels stay in L1/L2
+//! - Same topology and depth-first order as the BVH it was made from
+//! - Quantized boxes are rounded outwards (and widened by a few ulps against
+//!   differences in float rounding between encoder and traversal), so a
+//!   decoded box always contains the real one: no hits are lost, some extra
+//!   boxes are entered
+//! - Trees whose leaves don't fit the quantized link fall back to BVHNodeFloat
+class BVHCompact {
+	BVHNodeFormat format;
+	std::vector<BVHNodeFloat32> nodesFloat;
+	std::vector<BVHNodeQuant<uint16_t> > nodes16;
+	std::vector<BVHNodeQuant<uint8_t> > nodes8;
+	BVHBounds root;
+	const std::vector<Object *> *prims;
+
+	template <typename Q>
+	void encode(const BVHFlatNode *flatTree, uint32_t nNodes, std::vector<BVHNodeQuant<Q> > &nodes);
+
+	template <typename Node>
+	bool traverse(const std::vector<Node> &nodes, const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+public:
+	BVHCompact(const BVH &bvh, BVHNodeFormat format);
+
+	bool getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	BVHNodeFormat getFormat() const { return format; }
+
+	uint32_t getNodeCount() const;
+
+	//! Bytes of node storage, to compare with getNodeCount() * sizeof(BVHFlatNode)
+	size_t getMemoryBytes() const;
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+const char *nodeFormatName(BVHNodeFormat format) {
+	switch (format) {
+	case BVHNodeQuant16:
+		return "Quant16";
+	case BVHNodeQuant8:
+		return "Quant8";
+	default:
+		return "Float32";
+	}
+}
+
+inline BVHNodeFloat32 compactNode(const BVHFlatNode &node) {
+	BVHNodeFloat32 out;
+	out.bounds.min = node.bbox.min;
+	out.bounds.max = node.bbox.max;
+	out.link = node.rightOffset ? node.rightOffset : node.start;
+	out.count = node.rightOffset ? 0 : node.nPrims;
+	return out;
+}
+
+//! Grid spacing of the children of a node with decoded box parent
+template <typename Q>
+static inline Vector3 quantStep(const BVHBounds &parent) {
+	return (parent.max - parent.min) * (1.f / std::numeric_limits<Q>::max());
+}
+
+//! Box of a quantized node within its parent's decoded box. The encoder uses
+//! the same functions, so what it checks is what traversal sees.
+template <typename Q>
+static inline void dequantize(const BVHBounds &parent, const Vector3 &step, const Q q[6], BVHBounds *box) {
+	for (uint32_t a = 0; a < 3; ++a) {
+		box->min[a] = parent.min[a] + step[a] * q[a];
+		box->max[a] = parent.max[a] - step[a] * q[3 + a];
+	}
+}
+
+//! Slab test as in BBox::intersect, on bounds without extent
+static inline bool intersectBounds(const BVHBounds &box, const Ray &ray, float *tnear, float *tfar) {
+	Vector3 tbot = ray.inv_d.cmul(box.min - ray.o);
+	Vector3 ttop = ray.inv_d.cmul(box.max - ray.o);
+
+	Vector3 tmin = ::min(ttop, tbot);
+	Vector3 tmax = ::max(ttop, tbot);
+
+	*tnear = std::max(std::max(tmin.x, tmin.y), tmin.z);
+	*tfar = std::min(std::min(tmax.x, tmax.y), tmax.z);
+
+	return !(*tnear > *tfar) && *tfar > 0;
+}
+
+//! Slab test of a node whose parent decoded to parent, with the grid spacing
+//! step = quantStep(parent). Quantized nodes also leave their decoded box in
+//! box, for decoding their own children.
+static inline bool intersectNode(const BVHNodeFloat32 &node, const BVHBounds &, const Vector3 &, const Ray &ray,
+								 BVHBounds *, float *tnear, float *tfar) {
+	return intersectBounds(node.bounds, ray, tnear, tfar);
+}
+
+template <typename Q>
+static inline bool intersectNode(const BVHNodeQuant<Q> &node, const BVHBounds &parent, const Vector3 &step,
+								 const Ray &ray, BVHBounds *box, float *tnear, float *tfar) {
+	dequantize(parent, step, node.q, box);
+	return intersectBounds(*box, ray, tnear, tfar);
+}
+
+//! quantStep() for the children of node, unused by float nodes
+static inline Vector3 childStep(const BVHNodeFloat32 &, const BVHBounds &) { return Vector3(0, 0, 0); }
+
+template <typename Q>
+static inline Vector3 childStep(const BVHNodeQuant<Q> &, const BVHBounds &box) { return quantStep<Q>(box); }
+
+static inline uint32_t nodeCount(const BVHNodeFloat32 &node) { return node.count; }
+
+static inline uint32_t nodeLink(const BVHNodeFloat32 &node) { return node.link; }
+
+template <typename Q>
+static inline uint32_t nodeCount(const BVHNodeQuant<Q> &node) { return node.link >> BVHQuantCountShift; }
+
+template <typename Q>
+static inline uint32_t nodeLink(const BVHNodeQuant<Q> &node) { return node.link & ((1u << BVHQuantCountShift) - 1); }
+
+BVHCompact::BVHCompact(const BVH &bvh, BVHNodeFormat format)
+		: format(format), prims(&bvh.getPrimitives()) {
+	Stopwatch sw;
+	const BVHFlatNode *flatTree = bvh.getFlatTree();
+	const uint32_t nNodes = bvh.getNodeCount();
+	root.min = flatTree[0].bbox.min;
+	root.max = flatTree[0].bbox.max;
+
+	// The quantized link has 27 bits of offset or start and 5 bits of count
+	if (format != BVHNodeFloat) {
+		for (uint32_t n = 0; n < nNodes; ++n) {
+			const BVHFlatNode &node(flatTree[n]);
+			uint32_t link = node.rightOffset ? node.rightOffset : node.start;
+			if (link >> BVHQuantCountShift || (node.rightOffset == 0 && node.nPrims >> (32 - BVHQuantCountShift))) {
+				LOG_WARNING("BVH too large for %s nodes, using %s", nodeFormatName(format), nodeFormatName(BVHNodeFloat));
+				this->format = BVHNodeFloat;
+				break;
+			}
+		}
+	}
+
+	if (this->format == BVHNodeQuant16) {
+		encode(flatTree, nNodes, nodes16);
+	} else if (this->format == BVHNodeQuant8) {
+		encode(flatTree, nNodes, nodes8);
+	} else {
+		nodesFloat.resize(nNodes);
+		for (uint32_t n = 0; n < nNodes; ++n)
+			nodesFloat[n] = compactNode(flatTree[n]);
+	}
+
+	LOG_STAT("Encoded %s BVH (%d nodes, %d KiB instead of %d KiB) in %d ms", nodeFormatName(this->format),
+			 (int) nNodes, (int) (getMemoryBytes() / 1024), (int) (nNodes * sizeof(BVHFlatNode) / 1024),
+			 (int) (1000 * sw.read()));
+}
+
+/*! Quantize every node within its parent's decoded box, top-down
+ *  - Parents precede their children in the depth-first flat tree, so the
+ *    parent's decoded box is always ready
+ *  - Rounding is outwards; each bound then steps further out until the
+ *    decoded box contains the node's box widened by a few ulps. Steps stop
+ *    at the parent's planes, which decode exactly.
+ */
+template <typename Q>
+void BVHCompact::encode(const BVHFlatNode *flatTree, uint32_t nNodes, std::vector<BVHNodeQuant<Q> > &nodes) {
+	const float levels = std::numeric_limits<Q>::max();
+	nodes.resize(nNodes);
+	std::vector<BVHBounds> decoded(nNodes);
+	std::vector<uint32_t> parent(nNodes, 0);
+	for (uint32_t n = 0; n < nNodes; ++n) {
+		if (flatTree[n].rightOffset) {
+			parent[n + 1] = n;
+			parent[n + flatTree[n].rightOffset] = n;
+		}
+	}
+
+	for (uint32_t n = 0; n < nNodes; ++n) {
+		const BVHFlatNode &node(flatTree[n]);
+		const BVHBounds &p = n == 0 ? root : decoded[parent[n]];
+		BVHNodeQuant<Q> &out(nodes[n]);
+
+		for (uint32_t a = 0; a < 3; ++a) {
+			float margin = 4e-7f * (fabsf(p.min[a]) + fabsf(p.max[a]));
+			float lo = node.bbox.min[a] - margin, hi = node.bbox.max[a] + margin;
+			float step = (p.max[a] - p.min[a]) / levels;
+			float qlo = step > 0.f ? floorf((lo - p.min[a]) / step) : 0.f;
+			float qhi = step > 0.f ? floorf((p.max[a] - hi) / step) : 0.f;
+			out.q[a] = (Q) std::max(0.f, std::min(levels, qlo));
+			out.q[3 + a] = (Q) std::max(0.f, std::min(levels, qhi));
+		}
+
+		const Vector3 pstep = quantStep<Q>(p);
+		BVHBounds box;
+		for (;;) {
+			dequantize(p, pstep, out.q, &box);
+			bool grown = false;
+			for (uint32_t a = 0; a < 3; ++a) {
+				float margin = 4e-7f * (fabsf(p.min[a]) + fabsf(p.max[a]));
+				if (box.min[a] > node.bbox.min[a] - margin && out.q[a] > 0) {
+					out.q[a]--;
+					grown = true;
+				}
+				if (box.max[a] < node.bbox.max[a] + margin && out.q[3 + a] > 0) {
+					out.q[3 + a]--;
+					grown = true;
+				}
+			}
+			if (!grown)
+				break;
+		}
+		decoded[n] = box;
+
+		out.link = node.rightOffset ? node.rightOffset : node.start | node.nPrims << BVHQuantCountShift;
+	}
+}
+
+uint32_t BVHCompact::getNodeCount() const {
+	if (format == BVHNodeQuant16)
+		return (uint32_t) nodes16.size();
+	if (format == BVHNodeQuant8)
+		return (uint32_t) nodes8.size();
+	return (uint32_t) nodesFloat.size();
+}
+
+size_t BVHCompact::getMemoryBytes() const {
+	return nodesFloat.size() * sizeof(BVHNodeFloat32) + nodes16.size() * sizeof(BVHNodeQuant<uint16_t>) +
+		   nodes8.size() * sizeof(BVHNodeQuant<uint8_t>);
+}
+
+bool BVHCompact::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	intersection->t = 999999999.f;
+	intersection->object = NULL;
+
+	if (format == BVHNodeQuant16)
+		traverse(nodes16, ray, intersection, occlusion);
+	else if (format == BVHNodeQuant8)
+		traverse(nodes8, ray, intersection, occlusion);
+	else
+		traverse(nodesFloat, ray, intersection, occlusion);
+
+	// If we hit something,
+	if (intersection->object != NULL)
+		intersection->hit = ray.o + ray.d * intersection->t;
+
+	return intersection->object != NULL;
+}
+
+//! Stack entry of the compact traversal: a node, its entry distance and, for
+//! quantized nodes, its decoded box (needed to decode its children)
+struct BVHCompactTraversal {
+	uint32_t i;
+	float mint;
+	BVHBounds box;
+};
+
+//! BVH::traverse() on compact nodes: children are decoded from the popped
+//! node's box before their slab tests
+template <typename Node>
+bool BVHCompact::traverse(const std::vector<Node> &nodes, const Ray &ray, IntersectionInfo *intersection,
+						  bool occlusion) const {
+	bool found = false;
+	float bbhits[4];
+	BVHBounds boxes[2];
+
+	// Working set
+	BVHCompactTraversal todo[64];
+	int32_t stackptr = 0;
+
+	// The root decodes within the exact root box
+	todo[stackptr].i = 0;
+	todo[stackptr].mint = -9999999.f;
+	todo[stackptr].box = root;
+	if (!intersectNode(nodes[0], root, childStep(nodes[0], root), ray, &todo[stackptr].box, bbhits, bbhits + 1))
+		return false;
+
+	while (stackptr >= 0) {
+		// Pop off the next node to work on. The entry stays valid until the
+		// children are pushed, which comes after decoding them.
+		const BVHCompactTraversal &entry = todo[stackptr--];
+		const Node &node(nodes[entry.i]);
+
+		// If this node is further than the closest found intersection, continue
+		if (entry.mint > intersection->t)
+			continue;
+
+		// Is leaf -> Intersect
+		uint32_t count = nodeCount(node);
+		if (count > 0) {
+			uint32_t start = nodeLink(node);
+			for (uint32_t o = 0; o < count; ++o) {
+				bool hit = (*prims)[start + o]->getIntersection(ray, intersection);
+				found |= hit;
+
+				// If we're only looking for occlusion, then any hit is good enough
+				if (occlusion && hit)
+					return true;
+			}
+			continue;
+		}
+
+		uint32_t child[2] = {entry.i + 1, entry.i + nodeLink(node)};
+		const Vector3 step = childStep(node, entry.box);
+		bool hitc0 = intersectNode(nodes[child[0]], entry.box, step, ray, boxes, bbhits, bbhits + 1);
+		bool hitc1 = intersectNode(nodes[child[1]], entry.box, step, ray, boxes + 1, bbhits + 2, bbhits + 3);
+
+		// Push the farther first, so the closer is popped next
+		uint32_t first = hitc0 && hitc1 && bbhits[2] < bbhits[0] ? 0 : 1;
+		for (uint32_t k = 0; k < 2; ++k) {
+			uint32_t c = k == 0 ? first : 1 - first;
+			if (!(c == 0 ? hitc0 : hitc1))
+				continue;
+			BVHCompactTraversal &t(todo[++stackptr]);
+			t.i = child[c];
+			t.mint = bbhits[2 * c];
+			if (Node::quantized)
+				t.box = boxes[c];
+		}
+	}
+
+	return found;
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef CompositeObject_h_
+#define CompositeObject_h_
+
+#include "Object.h"
+#include "Sphere.h"
+#include "BVH.h"
+#include "SphereBatch.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+// 由許多球組成的原型幾何 (prototype)
+// - 零件球以物件自己的座標系 (原點為物件中心) 存放，並建一棵自己的 BVH (bottom-level)
+// - 走訪時用的是 SoA 的 SphereBatch，順序和 BVH 的葉節點一致，
+//   葉節點裡的球一次用 SIMD 測 4/8 顆
+// - 同一種造型、同一個 scale 只會建一份，所有擺放位置 (instance) 共用
+class CompositeMesh
+{
+    SphereBatch spheres;            // BVH 葉節點順序，走訪和法向量都用這份
+    std::vector<Sphere> buildParts; // 建 BVH 用的輸入
+    std::vector<Object *> partPtrs; // BVH 的 primitive 順序
+    BVH *blas;
+    BBox bbox;
+
+public:
+    CompositeMesh() : blas(NULL) {}
+
+    CompositeMesh(const CompositeMesh &) = delete;
+    CompositeMesh &operator=(const CompositeMesh &) = delete;
+
+    virtual ~CompositeMesh()
+    {
+        delete blas;
+    }
+
+    // 光線必須已經轉到物件座標系；只接受比 I->t 更近的交點
+    bool intersect(const Ray &localRay, IntersectionInfo *I) const
+    {
+        return blas->traverse(localRay, I, false,
+                              [this, &localRay](uint32_t start, uint32_t nPrims, IntersectionInfo *I)
+                              {
+                                  float t;
+                                  int32_t hit = spheres.intersect(localRay, start, start + nPrims, I->t, &t);
+                                  if (hit < 0)
+                                      return false;
+                                  I->t = t;
+                                  I->primID = (uint32_t)hit; // 記下打到哪一顆球，法向量就不用再找
+                                  return true;
+                              });
+    }
+
+    // 法向量計算 (hitPoint 為物件座標系，part 為求交時記下的球)
+    Vector3 getNormal(Vector3 hitPoint, uint32_t part) const
+    {
+        return normalize(hitPoint - spheres.center(part));
+    }
+
+    const BBox &getBBox() const
+    {
+        return bbox;
+    }
+
+    uint32_t getSphereCount() const
+    {
+        return spheres.size();
+    }
+
+    // 存成快取檔 (SceneCache) 時要讀出原型的 BVH 和球
+    const BVH &getBLAS() const
+    {
+        return *blas;
+    }
+
+    const SphereBatch &getSpheres() const
+    {
+        return spheres;
+    }
+
+    // 所有原型的 BVH 都用這組設定 (快取檔的 key 也要算進去)
+    static BVHBuildOptions blasOptions()
+    {
+        // 葉節點一次測 8 顆球剛好是一個 AVX 向量
+        BVHBuildOptions options(8);
+        options.splitMethod = SplitSAH;
+        options.logStats = false;
+        return options;
+    }
+
+protected:
+    // 基本加球函式
+    void addSphere(Vector3 c, float r)
+    {
+        buildParts.push_back(Sphere(c, r));
+
+        if (buildParts.size() == 1)
+            bbox = buildParts[0].getBBox();
+        else
+            bbox.expandToInclude(buildParts.back().getBBox());
+    }
+
+    // 進階：畫管狀物 (Tube) / 連續球體
+    // p1: 起點, p2: 終點, r1: 起點半徑, r2: 終點半徑, steps: 切分多少顆球
+    void addTube(Vector3 p1, Vector3 p2, float r1, float r2, int steps)
+    {
+        for (int i = 0; i <= steps; ++i)
+        {
+            float t = (float)i / steps;
+            // 線性插值位置
+            Vector3 pos = p1 * (1.0f - t) + p2 * t;
+            // 線性插值半徑
+            float r = r1 * (1.0f - t) + r2 * t;
+
+            addSphere(pos, r);
+        }
+    }
+
+    // 所有零件加完之後呼叫，建立物件自己的 BVH，再依葉節點順序排好 SphereBatch
+    void buildBLAS()
+    {
+        partPtrs.clear();
+        for (Sphere &s : buildParts)
+            partPtrs.push_back(&s);
+
+        delete blas;
+        blas = new BVH(&partPtrs, blasOptions());
+
+        spheres.clear();
+        for (const Object *p : blas->getPrimitives())
+        {
+            const Sphere *s = static_cast<const Sphere *>(p);
+            spheres.add(s->getCentroid(), s->getRadius());
+        }
+    }
+};
+
+// 取得共用的原型：每一種 MeshType 與 scale 只建一次，程式結束前都不會釋放
+template <typename MeshType>
+const CompositeMesh *sharedMesh(float scale)
+{
+    static std::map<float, std::unique_ptr<MeshType> > cache;
+
+    std::unique_ptr<MeshType> &mesh = cache[scale];
+    if (!mesh)
+        mesh.reset(new MeshType(scale));
+    return mesh.get();
+}
+
+// 複合物件的一個擺放位置 (instance)
+// - 只記錄共用原型的指標、平移量和世界座標的 BBox
+// - 場景的 BVH (top-level) 打到這個物件時，光線只轉換一次到物件座標系，
+//   再帶著目前最近的 t 往下走原型的 BVH，比較遠的節點和球都可以提早剔除
+class CompositeObject : public Object
+{
+    const CompositeMesh *mesh;
+    Vector3 translation;
+    BBox bbox;
+
+public:
+    CompositeObject(const CompositeMesh *mesh, const Vector3 &pos)
+        : mesh(mesh), translation(pos),
+          bbox(mesh->getBBox().min + pos, mesh->getBBox().max + pos) {}
+
+    bool getIntersection(const Ray &ray, IntersectionInfo *I) const override
+    {
+        // 優化：先檢查整體的 BBox，如果光線沒碰到盒子，或盒子比目前最近的交點還遠，就不用往下走了
+        float tmin, tmax;
+        if (!bbox.intersect(ray, &tmin, &tmax) || tmin > I->t)
+            return false;
+
+        // 只有平移，方向 (和 1/方向) 不變，t 在兩個座標系裡也相同
+        Ray localRay(ray.o - translation, ray.d, ray.inv_d);
+        if (!mesh->intersect(localRay, I))
+            return false;
+
+        I->object = this;
+        return true;
+    }
+
+    Vector3 getNormal(const IntersectionInfo &I) const override
+    {
+        return mesh->getNormal(I.hit - translation, I.primID);
+    }
+
+    BBox getBBox() const override
+    {
+        return bbox;
+    }
+
+    Vector3 getCentroid() const override
+    {
+        return translation;
+    }
+
+    const CompositeMesh *getMesh() const
+    {
+        return mesh;
+    }
+
+    const Vector3 &getTranslation() const
+    {
+        return translation;
+    }
+
+    // 移動到新的位置 (動畫用)；場景的 BVH 之後要 refit()
+    void setTranslation(const Vector3 &pos)
+    {
+        translation = pos;
+        bbox = BBox(mesh->getBBox().min + pos, mesh->getBBox().max + pos);
+    }
+};
+
+#endif
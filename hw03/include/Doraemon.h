@@ -1,28 +1,19 @@
 #ifndef Doraemon_h_
 #define Doraemon_h_
 
-#include "Object.h"
-#include "Sphere.h"
+#include "CompositeObject.h"
 #include <vector>
 #include <cmath>
 #include <algorithm>
 
-class Doraemon : public Object
+// 哆啦A夢的原型幾何，以物件中心為原點，所有擺放位置共用一份
+class DoraemonMesh : public CompositeMesh
 {
-    struct SphereData
-    {
-        Vector3 c;
-        float r;
-    };
-
-    std::vector<Sphere *> parts;
-    std::vector<SphereData> partsData;
-    Vector3 centerPos;
-    BBox bbox;
-
 public:
-    Doraemon(const Vector3 &pos, float scale) : centerPos(pos)
+    DoraemonMesh(float scale)
     {
+        const Vector3 pos(0, 0, 0);
+
         // --- 1. 頭部 (Head) ---
         // 藍色大頭
         addSphere(pos + Vector3(0, 10, 0) * scale, 10.0f * scale);
@@ -108,102 +99,16 @@ public:
 
         // 稍微修飾兩腿中間的空隙，讓它不要看起來像浮在空中
         addSphere(pos + Vector3(0, -13, 0) * scale, 2.0f * scale);
-    }
-
-    ~Doraemon()
-    {
-        for (Sphere *s : parts)
-            delete s;
-        parts.clear();
-    }
-
-    bool getIntersection(const Ray &ray, IntersectionInfo *I) const override
-    {
-        bool hitAny = false;
-        float closestT = 1e9;
-        IntersectionInfo tempI;
 
-        // 優化：先檢查整體的 BBox，如果光線完全沒碰到盒子，就不用檢查幾百顆球了
-        float tmin, tmax;
-        if (!bbox.intersect(ray, &tmin, &tmax))
-            return false;
-
-        for (const auto &part : parts)
-        {
-            if (part->getIntersection(ray, &tempI))
-            {
-                if (tempI.t < closestT)
-                {
-                    closestT = tempI.t;
-                    *I = tempI;
-                    I->object = this;
-                    hitAny = true;
-                }
-            }
-        }
-        return hitAny;
-    }
-
-    Vector3 getNormal(const IntersectionInfo &I) const override
-    {
-        return getNormalInternal(I.hit);
+        buildBLAS();
     }
+};
 
-    BBox getBBox() const override
-    {
-        return bbox;
-    }
-
-    Vector3 getCentroid() const override
-    {
-        return centerPos;
-    }
-
-private:
-    void addSphere(Vector3 c, float r)
-    {
-        parts.push_back(new Sphere(c, r));
-        partsData.push_back({c, r});
-
-        if (parts.size() == 1)
-            bbox = parts[0]->getBBox();
-        else
-            bbox.expandToInclude(parts.back()->getBBox());
-    }
-
-    // 畫線/管子工具
-    void addTube(Vector3 p1, Vector3 p2, float r1, float r2, int steps)
-    {
-        for (int i = 0; i <= steps; ++i)
-        {
-            float t = (float)i / steps;
-            Vector3 pos = p1 * (1.0f - t) + p2 * t;
-            float r = r1 * (1.0f - t) + r2 * t;
-            addSphere(pos, r);
-        }
-    }
-
-    Vector3 getNormalInternal(Vector3 hitPoint) const
-    {
-        float minError = 1e9;
-        int bestIdx = 0;
-
-        for (size_t i = 0; i < partsData.size(); ++i)
-        {
-            Vector3 diff = hitPoint - partsData[i].c;
-            // 手動計算距離
-            float distSq = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
-            float dist = std::sqrt(distSq);
-
-            float error = std::abs(dist - partsData[i].r);
-            if (error < minError)
-            {
-                minError = error;
-                bestIdx = i;
-            }
-        }
-        return normalize(hitPoint - partsData[bestIdx].c);
-    }
+// 哆啦A夢的一個擺放位置
+class Doraemon : public CompositeObject
+{
+public:
+    Doraemon(const Vector3 &pos, float scale) : CompositeObject(sharedMesh<DoraemonMesh>(scale), pos) {}
 };
 
 #endif
\ No newline at end of file
@@ -1,12 +1,17 @@
 #ifndef IntersectionInfo_h_
 #define IntersectionInfo_h_
 
+#include <stdint.h>
+#include "Vector3.h"
+
 class Object;
 
 struct IntersectionInfo {
  float t; // Intersection distance along the ray
  const Object* object; // Object that was hit
  Vector3 hit; // Location of the intersection
+ uint32_t primID; // Sub-part that was hit (e.g. sphere index inside a composite object)
+ uint32_t instID; // Instance that was hit, where one Object stands for many (SceneCache)
 };
 
 #endif
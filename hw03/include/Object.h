@@ -6,7 +6,11 @@
 #include "BBox.h"
 
 struct Object {
+	virtual ~Object() {}
+
 	//! All "Objects" must be able to test for intersections with rays.
+	//! Only hits in front of the ray origin and closer than intersection->t
+	//! count; on such a hit the object fills in intersection and returns true.
 	virtual bool getIntersection(
 			const Ray &ray,
 			IntersectionInfo *intersection)
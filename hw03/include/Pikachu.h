@@ -1,29 +1,20 @@
 #ifndef Pikachu_h_
 #define Pikachu_h_
 
-#include "Object.h"
-#include "Sphere.h"
+#include "CompositeObject.h"
 #include <vector>
 #include <cmath>
 #include <algorithm>
 
 // 皮卡丘複合物件 (High-Res Version)
-class Pikachu : public Object
+// 原型幾何以物件中心為原點，所有擺放位置共用一份
+class PikachuMesh : public CompositeMesh
 {
-    struct SphereData
-    {
-        Vector3 c;
-        float r;
-    };
-
-    std::vector<Sphere *> parts;
-    std::vector<SphereData> partsData; // 備份資料用於計算法向量
-    Vector3 centerPos;
-    BBox bbox;
-
 public:
-    Pikachu(const Vector3 &pos, float scale) : centerPos(pos)
+    PikachuMesh(float scale)
     {
+        const Vector3 pos(0, 0, 0);
+
         // --- 1. 頭部與身體 (Head & Body) ---
         // 臉稍微寬一點，比較可愛
         addSphere(pos + Vector3(0, 5.5, 0) * scale, 5.8f * scale);
@@ -97,104 +88,16 @@ public:
         addTube(pos + Vector3(4, 2, -5) * scale,
                 pos + Vector3(2, 7, -6) * scale,
                 1.5f * scale, 2.5f * scale, 6);
-    }
-
-    ~Pikachu()
-    {
-        for (Sphere *s : parts)
-            delete s;
-        parts.clear();
-    }
-
-    bool getIntersection(const Ray &ray, IntersectionInfo *I) const override
-    {
-        bool hitAny = false;
-        float closestT = 1e9;
-        IntersectionInfo tempI;
-
-        // 檢查每一個零件球
-        for (const auto &part : parts)
-        {
-            if (part->getIntersection(ray, &tempI))
-            {
-                if (tempI.t < closestT)
-                {
-                    closestT = tempI.t;
-                    *I = tempI;
-                    I->object = this;
-                    hitAny = true;
-                }
-            }
-        }
-        return hitAny;
-    }
-
-    Vector3 getNormal(const IntersectionInfo &I) const override
-    {
-        return getNormalInternal(I.hit);
-    }
-
-    BBox getBBox() const override
-    {
-        return bbox;
-    }
-
-    Vector3 getCentroid() const override
-    {
-        return centerPos;
-    }
-
-private:
-    // 基本加球函式
-    void addSphere(Vector3 c, float r)
-    {
-        parts.push_back(new Sphere(c, r));
-        partsData.push_back({c, r});
 
-        if (parts.size() == 1)
-            bbox = parts[0]->getBBox();
-        else
-            bbox.expandToInclude(parts.back()->getBBox());
-    }
-
-    // 進階：畫管狀物 (Tube) / 連續球體
-    // p1: 起點, p2: 終點, r1: 起點半徑, r2: 終點半徑, steps: 切分多少顆球
-    void addTube(Vector3 p1, Vector3 p2, float r1, float r2, int steps)
-    {
-        for (int i = 0; i <= steps; ++i)
-        {
-            float t = (float)i / steps;
-            // 線性插值位置
-            Vector3 pos = p1 * (1.0f - t) + p2 * t;
-            // 線性插值半徑
-            float r = r1 * (1.0f - t) + r2 * t;
-
-            addSphere(pos, r);
-        }
+        buildBLAS();
     }
+};
 
-    // 法向量計算
-    Vector3 getNormalInternal(Vector3 hitPoint) const
-    {
-        float minError = 1e9;
-        int bestIdx = 0;
-
-        for (size_t i = 0; i < partsData.size(); ++i)
-        {
-            // 計算距離：在你的 Vector3 中，* 是內積，所以 sqrt(diff * diff) 是長度
-            Vector3 diff = hitPoint - partsData[i].c;
-            float dist = std::sqrt(diff * diff);
-
-            float error = std::abs(dist - partsData[i].r);
-            if (error < minError)
-            {
-                minError = error;
-                bestIdx = i;
-            }
-        }
-
-        return normalize(hitPoint - partsData[bestIdx].c);
-    }
+// 皮卡丘的一個擺放位置
+class Pikachu : public CompositeObject
+{
+public:
+    Pikachu(const Vector3 &pos, float scale) : CompositeObject(sharedMesh<PikachuMesh>(scale), pos) {}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef RandomScene_h
+#define RandomScene_h
+
+// Random scenes shared by main.cpp and the benchmarks. Every program is built
+// the same way, e.g.
+//   g++ -O2 -std=gnu++17 -Iinclude LBVHBench.cpp -o LBVHBench -pthread
+// (add -march=native to use the AVX kernels)
+
+#include <cstdlib>
+#include <vector>
+#include "Doraemon.h"
+#include "Pikachu.h"
+#include "Vector3.h"
+
+// Numbers drawn from the rand() stream so far
+unsigned long long randDraws = 0;
+
+// Return a random number in [0,1]
+float rand01()
+{
+	randDraws++;
+	return rand() * (1.f / RAND_MAX);
+}
+
+// Return a random vector with each component in the range [-1,1]
+Vector3 randVector3()
+{
+	return Vector3(rand01(), rand01(), rand01()) * 2.f - Vector3(1, 1, 1);
+}
+
+// Size of the shared meshes every scene object instances
+const float sceneObjectScale = 0.01f;
+
+// The i-th object of a scene: Doraemon and Pikachu take turns
+CompositeObject *sceneObject(int i, const Vector3 &position)
+{
+	if (i % 2 == 0)
+		return new Doraemon(position, sceneObjectScale);
+	return new Pikachu(position, sceneObjectScale);
+}
+
+// Append N objects placed uniformly in [-scale,scale]^3, three rand() draws each
+void randomScene(std::vector<Object *> &objects, int N, float scale)
+{
+	for (int i = 0; i < N; ++i)
+		objects.push_back(sceneObject(i, randVector3() * scale));
+}
+
+#endif
@@ -10,6 +10,10 @@ struct Ray {
 
 	Ray(const Vector3 &o, const Vector3 &d)
 			: o(o), d(d), inv_d(Vector3(1, 1, 1).cdiv(d)) {}
+
+	// For rays derived from another one (e.g. moved into object space), reusing its inverse direction
+	Ray(const Vector3 &o, const Vector3 &d, const Vector3 &inv_d)
+			: o(o), d(d), inv_d(inv_d) {}
 };
 
 #endif
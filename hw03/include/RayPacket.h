@@ -0,0 +1,230 @@
+#ifndef RayPacket_h
+#define RayPacket_h
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include "Vector3.h"
+#include "Ray.h"
+#include "BBox.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Rays per packet: one AVX register (or two SSE registers) per field
+const uint32_t RayPacketSize = 8;
+
+//! Pixel block a primary packet covers, RayPacketWidth x (RayPacketSize / RayPacketWidth)
+const uint32_t RayPacketWidth = 4;
+
+//! Packets with at most this many rays still active have diverged, and finish
+//! the subtree one ray at a time
+const uint32_t RayPacketDivergent = 2;
+
+//! Up to RayPacketSize rays in SoA form, so a box is tested against all of
+//! them with one SIMD operation per plane
+//! - Lanes past count repeat lane 0 (see finalize()) and are never in a mask
+//! - For frustum culling, the packet also keeps the bounds of its origins and
+//!   inverse directions. When every axis has a single direction sign these
+//!   bound the t interval of every ray against a box (interval arithmetic),
+//!   so one scalar test can reject a box for the whole packet.
+struct alignas(32) RayPacket {
+	float ox[RayPacketSize], oy[RayPacketSize], oz[RayPacketSize];
+	float dx[RayPacketSize], dy[RayPacketSize], dz[RayPacketSize];
+	float ix[RayPacketSize], iy[RayPacketSize], iz[RayPacketSize];
+	uint32_t count;
+
+	Vector3 originMin, originMax, invMin, invMax;
+	bool coherent; // The bounds above form a usable frustum
+
+	RayPacket() : count(0), coherent(false) {}
+
+	//! Append a ray; at most RayPacketSize
+	void add(const Ray &ray);
+
+	//! Fill the unused lanes and compute the frustum. Call once all rays are added.
+	void finalize();
+
+	Ray ray(uint32_t lane) const;
+
+	//! Bit i set for each ray i of the packet
+	uint32_t activeMask() const { return count >= 32 ? 0xffffffffu : (1u << count) - 1; }
+
+	//! Slab test of all rays against the box, with the acceptance of BBox::intersect
+	//! plus culling against each ray's closest hit tmax[i]. Writes the entry
+	//! distances and returns the mask of rays that hit.
+	uint32_t intersect(const BBox &box, const float tmax[RayPacketSize], float tnear[RayPacketSize]) const;
+
+	//! True if no ray of the packet can hit the box closer than tmax. Conservative:
+	//! false whenever the packet isn't coherent.
+	bool frustumMisses(const BBox &box, float tmax) const;
+};
+
+//! Number of set bits (active rays) of a mask
+inline uint32_t countLanes(uint32_t mask);
+
+//! Index of the lowest set bit of a non-zero mask
+inline uint32_t firstLane(uint32_t mask);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+inline uint32_t countLanes(uint32_t mask) {
+	uint32_t n = 0;
+	for (; mask; mask &= mask - 1)
+		++n;
+	return n;
+}
+
+inline uint32_t firstLane(uint32_t mask) {
+#if defined(__GNUC__)
+	return (uint32_t) __builtin_ctz(mask);
+#else
+	uint32_t i = 0;
+	while (!(mask & 1u)) {
+		mask >>= 1;
+		++i;
+	}
+	return i;
+#endif
+}
+
+void RayPacket::add(const Ray &ray) {
+	uint32_t i = count++;
+	ox[i] = ray.o.x;
+	oy[i] = ray.o.y;
+	oz[i] = ray.o.z;
+	dx[i] = ray.d.x;
+	dy[i] = ray.d.y;
+	dz[i] = ray.d.z;
+	ix[i] = ray.inv_d.x;
+	iy[i] = ray.inv_d.y;
+	iz[i] = ray.inv_d.z;
+}
+
+Ray RayPacket::ray(uint32_t lane) const {
+	return Ray(Vector3(ox[lane], oy[lane], oz[lane]), Vector3(dx[lane], dy[lane], dz[lane]),
+			   Vector3(ix[lane], iy[lane], iz[lane]));
+}
+
+void RayPacket::finalize() {
+	coherent = count > 0;
+	if (!coherent)
+		return;
+
+	// Copies of a real ray keep the SIMD lanes free of garbage (and of NaN slowdowns)
+	for (uint32_t i = count; i < RayPacketSize; ++i) {
+		ox[i] = ox[0]; oy[i] = oy[0]; oz[i] = oz[0];
+		dx[i] = dx[0]; dy[i] = dy[0]; dz[i] = dz[0];
+		ix[i] = ix[0]; iy[i] = iy[0]; iz[i] = iz[0];
+	}
+
+	originMin = originMax = Vector3(ox[0], oy[0], oz[0]);
+	invMin = invMax = Vector3(ix[0], iy[0], iz[0]);
+	for (uint32_t i = 1; i < count; ++i) {
+		Vector3 o(ox[i], oy[i], oz[i]), inv(ix[i], iy[i], iz[i]);
+		originMin = ::min(originMin, o);
+		originMax = ::max(originMax, o);
+		invMin = ::min(invMin, inv);
+		invMax = ::max(invMax, inv);
+	}
+
+	// Mixed signs (or an axis-parallel ray, whose inverse is infinite) leave no frustum
+	for (uint32_t a = 0; a < 3; ++a) {
+		if (!(invMin[a] > 0.f || invMax[a] < 0.f) || !std::isfinite(invMin[a]) || !std::isfinite(invMax[a]))
+			coherent = false;
+	}
+}
+
+uint32_t RayPacket::intersect(const BBox &box, const float tmax[RayPacketSize], float tnear[RayPacketSize]) const {
+	const float *origin[3] = {ox, oy, oz};
+	const float *inverse[3] = {ix, iy, iz};
+
+#if defined(__AVX__)
+	__m256 tn = _mm256_set1_ps(-1e30f);
+	__m256 tf = _mm256_set1_ps(1e30f);
+	for (uint32_t a = 0; a < 3; ++a) {
+		__m256 o = _mm256_load_ps(origin[a]);
+		__m256 inv = _mm256_load_ps(inverse[a]);
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min[a]), o), inv);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max[a]), o), inv);
+		tn = _mm256_max_ps(tn, _mm256_min_ps(t0, t1));
+		tf = _mm256_min_ps(tf, _mm256_max_ps(t0, t1));
+	}
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(tn, tf, _CMP_NGT_UQ), _mm256_cmp_ps(tf, _mm256_setzero_ps(), _CMP_GT_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(tn, _mm256_loadu_ps(tmax), _CMP_NGT_UQ));
+	_mm256_storeu_ps(tnear, tn);
+	uint32_t mask = (uint32_t) _mm256_movemask_ps(hit);
+#elif defined(__SSE__) || defined(_M_X64)
+	uint32_t mask = 0;
+	for (uint32_t half = 0; half < RayPacketSize; half += 4) {
+		__m128 tn = _mm_set1_ps(-1e30f);
+		__m128 tf = _mm_set1_ps(1e30f);
+		for (uint32_t a = 0; a < 3; ++a) {
+			__m128 o = _mm_load_ps(origin[a] + half);
+			__m128 inv = _mm_load_ps(inverse[a] + half);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min[a]), o), inv);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max[a]), o), inv);
+			tn = _mm_max_ps(tn, _mm_min_ps(t0, t1));
+			tf = _mm_min_ps(tf, _mm_max_ps(t0, t1));
+		}
+		__m128 hit = _mm_and_ps(_mm_cmpngt_ps(tn, tf), _mm_cmpgt_ps(tf, _mm_setzero_ps()));
+		hit = _mm_and_ps(hit, _mm_cmpngt_ps(tn, _mm_loadu_ps(tmax + half)));
+		_mm_storeu_ps(tnear + half, tn);
+		mask |= (uint32_t) _mm_movemask_ps(hit) << half;
+	}
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < RayPacketSize; ++i) {
+		float tn = -1e30f, tf = 1e30f;
+		for (uint32_t a = 0; a < 3; ++a) {
+			float t0 = (box.min[a] - origin[a][i]) * inverse[a][i];
+			float t1 = (box.max[a] - origin[a][i]) * inverse[a][i];
+			tn = std::max(tn, std::min(t0, t1));
+			tf = std::min(tf, std::max(t0, t1));
+		}
+		tnear[i] = tn;
+		if (!(tn > tf) && tf > 0 && !(tn > tmax[i]))
+			mask |= 1u << i;
+	}
+#endif
+
+	return mask & activeMask();
+}
+
+/*! Interval arithmetic over the packet: with o in [originMin, originMax] and
+ *  1/d in [invMin, invMax] (one sign per axis), every ray's entry distance
+ *  on an axis is at least the smallest corner product of its near plane, and
+ *  its exit distance at most the largest corner product of its far plane.
+ *  If even the latest possible exit comes before the earliest possible entry,
+ *  behind the origin, or past tmax, no ray of the packet hits the box.
+ */
+bool RayPacket::frustumMisses(const BBox &box, float tmax) const {
+	if (!coherent)
+		return false;
+
+	float nearLo = -1e30f, farHi = 1e30f;
+	for (uint32_t a = 0; a < 3; ++a) {
+		bool positive = invMin[a] > 0.f;
+		float nearPlane = positive ? box.min[a] : box.max[a];
+		float farPlane = positive ? box.max[a] : box.min[a];
+
+		float n0 = (nearPlane - originMin[a]) * invMin[a], n1 = (nearPlane - originMin[a]) * invMax[a];
+		float n2 = (nearPlane - originMax[a]) * invMin[a], n3 = (nearPlane - originMax[a]) * invMax[a];
+		float f0 = (farPlane - originMin[a]) * invMin[a], f1 = (farPlane - originMin[a]) * invMax[a];
+		float f2 = (farPlane - originMax[a]) * invMin[a], f3 = (farPlane - originMax[a]) * invMax[a];
+
+		nearLo = std::max(nearLo, std::min(std::min(n0, n1), std::min(n2, n3)));
+		farHi = std::min(farHi, std::max(std::max(f0, f1), std::max(f2, f3)));
+	}
+	return nearLo > farHi || !(farHi > 0.f) || nearLo > tmax;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef Renderer_h
+#define Renderer_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+#include "Vector3.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "IntersectionInfo.h"
+#include "Object.h"
+#include "ThreadPool.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Pinhole camera producing the primary rays of a square image
+struct Camera {
+	Vector3 position, dir, u, v;
+	float fov;
+	int width, height;
+
+	Camera(const Vector3 &position, const Vector3 &focus, const Vector3 &up, int width, int height);
+
+	//! Primary ray through the center of pixel (i, j)
+	Ray primaryRay(int i, int j) const;
+};
+
+//! Rectangle of pixels [x0, x1) x [y0, y1)
+struct Tile {
+	int x0, y0, x1, y1;
+};
+
+//! Split the image into tiles, ordered along a Z-order (Morton) curve so
+//! that neighbouring tasks touch neighbouring parts of the scene
+std::vector<Tile> makeTiles(int width, int height, int tileSize);
+
+//! Color a pixel from the closest hit (black on a miss)
+void shade(bool hit, const IntersectionInfo &I, float *pixel);
+
+//! Raytrace one tile, row by row, into the row-major RGB pixel buffer
+template <typename Accel>
+void renderTile(const Accel &accel, const Camera &camera, const Tile &tile, float *pixels);
+
+//! Raytrace one tile in blocks of RayPacketWidth x (RayPacketSize / RayPacketWidth)
+//! pixels, one coherent RayPacket per block (partial blocks at the edges of the
+//! tile fill fewer lanes). Accel must provide
+//! getIntersection(const RayPacket &, IntersectionInfo *, bool) returning the hit mask.
+template <typename Accel>
+void renderTilePackets(const Accel &accel, const Camera &camera, const Tile &tile, float *pixels);
+
+//! Raytrace the whole image on the pool. Every pixel is computed exactly as
+//! in the serial loop, so the result does not depend on the thread count.
+template <typename Accel>
+void renderImage(const Accel &accel, const Camera &camera, float *pixels, ThreadPool &pool, int tileSize = 32);
+
+//! renderImage() with renderTilePackets() for every tile
+template <typename Accel>
+void renderImagePackets(const Accel &accel, const Camera &camera, float *pixels, ThreadPool &pool, int tileSize = 32);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+Camera::Camera(const Vector3 &position, const Vector3 &focus, const Vector3 &up, int width, int height)
+		: position(position), width(width), height(height) {
+	// Camera tangent space
+	dir = normalize(focus - position);
+	u = normalize(dir ^ up);
+	v = normalize(u ^ dir);
+	fov = .5f / tanf(70.f * 3.14159265 * .5f / 180.f);
+}
+
+Ray Camera::primaryRay(int i, int j) const {
+	float pu = (i + .5f) / (float) (width - 1) - .5f;
+	float pv = (height - 1 - j + .5f) / (float) (height - 1) - .5f;
+
+	// This is only valid for square aspect ratio images
+	return Ray(position, normalize(pu * u + pv * v + fov * dir));
+}
+
+//! Interleave the lower 16 bits of x and y
+static uint32_t mortonCode2(uint32_t x, uint32_t y) {
+	uint32_t code = 0;
+	for (uint32_t b = 0; b < 16; ++b)
+		code |= ((x >> b) & 1u) << (2 * b) | ((y >> b) & 1u) << (2 * b + 1);
+	return code;
+}
+
+std::vector<Tile> makeTiles(int width, int height, int tileSize) {
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+
+	std::vector<std::pair<uint32_t, Tile> > keyed;
+	keyed.reserve(tilesX * tilesY);
+	for (int ty = 0; ty < tilesY; ++ty) {
+		for (int tx = 0; tx < tilesX; ++tx) {
+			Tile t;
+			t.x0 = tx * tileSize;
+			t.y0 = ty * tileSize;
+			t.x1 = std::min(width, t.x0 + tileSize);
+			t.y1 = std::min(height, t.y0 + tileSize);
+			keyed.push_back(std::make_pair(mortonCode2(tx, ty), t));
+		}
+	}
+	std::sort(keyed.begin(), keyed.end(),
+			  [](const std::pair<uint32_t, Tile> &a, const std::pair<uint32_t, Tile> &b) { return a.first < b.first; });
+
+	std::vector<Tile> tiles;
+	tiles.reserve(keyed.size());
+	for (const auto &k : keyed)
+		tiles.push_back(k.second);
+	return tiles;
+}
+
+void shade(bool hit, const IntersectionInfo &I, float *pixel) {
+	if (!hit) {
+		pixel[0] = pixel[1] = pixel[2] = 0.f;
+		return;
+	}
+
+	// Just for fun, we'll make the color based on the normal
+	const Vector3 normal = I.object->getNormal(I);
+	pixel[0] = fabs(normal.x);
+	pixel[1] = fabs(normal.y);
+	pixel[2] = fabs(normal.z);
+}
+
+template <typename Accel>
+void renderTile(const Accel &accel, const Camera &camera, const Tile &tile, float *pixels) {
+	for (int j = tile.y0; j < tile.y1; ++j) {
+		for (int i = tile.x0; i < tile.x1; ++i) {
+			Ray ray = camera.primaryRay(i, j);
+
+			IntersectionInfo I;
+			bool hit = accel.getIntersection(ray, &I, false);
+			shade(hit, I, pixels + 3 * ((size_t) camera.width * j + i));
+		}
+	}
+}
+
+template <typename Accel>
+void renderTilePackets(const Accel &accel, const Camera &camera, const Tile &tile, float *pixels) {
+	const int blockHeight = RayPacketSize / RayPacketWidth;
+	IntersectionInfo I[RayPacketSize];
+
+	for (int by = tile.y0; by < tile.y1; by += blockHeight) {
+		for (int bx = tile.x0; bx < tile.x1; bx += RayPacketWidth) {
+			int x1 = std::min(tile.x1, bx + (int) RayPacketWidth);
+			int y1 = std::min(tile.y1, by + blockHeight);
+
+			RayPacket packet;
+			for (int j = by; j < y1; ++j) {
+				for (int i = bx; i < x1; ++i)
+					packet.add(camera.primaryRay(i, j));
+			}
+			packet.finalize();
+
+			uint32_t hits = accel.getIntersection(packet, I, false);
+
+			// Lanes were filled row by row over the clipped block
+			uint32_t lane = 0;
+			for (int j = by; j < y1; ++j) {
+				for (int i = bx; i < x1; ++i, ++lane)
+					shade((hits >> lane) & 1u, I[lane], pixels + 3 * ((size_t) camera.width * j + i));
+			}
+		}
+	}
+}
+
+/*! Tiles are handed out in contiguous runs of the Z-order curve, one run per
+ *  pool participant, so every thread starts on a compact region of the image.
+ *  Threads that run dry steal from the far end of another thread's run.
+ */
+template <typename TileRenderer>
+static void renderTiles(const Camera &camera, ThreadPool &pool, int tileSize, const TileRenderer &render) {
+	std::vector<Tile> tiles = makeTiles(camera.width, camera.height, tileSize);
+	const size_t nTiles = tiles.size();
+
+	for (size_t t = 0; t < nTiles; ++t) {
+		const Tile tile = tiles[t];
+		pool.submit([&render, tile] { render(tile); }, (int32_t) (t * pool.size() / nTiles));
+	}
+	pool.wait();
+}
+
+template <typename Accel>
+void renderImage(const Accel &accel, const Camera &camera, float *pixels, ThreadPool &pool, int tileSize) {
+	renderTiles(camera, pool, tileSize,
+				[&accel, &camera, pixels](const Tile &tile) { renderTile(accel, camera, tile, pixels); });
+}
+
+template <typename Accel>
+void renderImagePackets(const Accel &accel, const Camera &camera, float *pixels, ThreadPool &pool, int tileSize) {
+	renderTiles(camera, pool, tileSize,
+				[&accel, &camera, pixels](const Tile &tile) { renderTilePackets(accel, camera, tile, pixels); });
+}
+
+#endif
@@ -0,0 +1,598 @@
+#ifndef SceneCache_h
+#define SceneCache_h
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <map>
+#include <vector>
+#include "BVH.h"
+#include "BVHCompact.h"
+#include "CompositeObject.h"
+#include "SphereBatch.h"
+#include "Object.h"
+#include "IntersectionInfo.h"
+#include "Ray.h"
+#include "Log.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Bumped whenever the layout below changes; older files are then rejected
+const uint32_t SceneCacheVersion = 1;
+
+//! Written as a native uint32_t; reads back differently on a machine of the other byte order
+const uint32_t SceneCacheByteOrder = 0x01020304;
+
+//! Sections start on cache lines, so mapped arrays are as aligned as in memory
+const uint64_t SceneCacheAlign = 64;
+
+//! Byte range [offset, offset + bytes) of the file
+struct SceneCacheSection {
+	uint64_t offset, bytes;
+};
+
+//! First bytes of a cache file
+//! - Everything after the header is plain arrays addressed by file offsets,
+//!   so the file can be mapped at any address and used in place
+//! - sceneKey identifies the scene the file was made for (the caller hashes
+//!   whatever generated the scene); a different key means a stale file
+struct SceneCacheHeader {
+	char magic[8];
+	uint32_t version, byteOrder;
+	uint32_t headerBytes, nodeBytes; // sizeof(SceneCacheHeader) and sizeof(BVHNodeFloat32) of the writer
+	uint64_t sceneKey;
+	uint64_t fileBytes;
+	uint64_t checksum; // sceneCacheChecksum() of bytes [headerBytes, fileBytes)
+	uint32_t nNodes, nInstances, nMeshes, reserved;
+	SceneCacheSection nodes;     // Top-level tree: nNodes BVHNodeFloat32, leafs index instances
+	SceneCacheSection instances; // nInstances SceneCacheInstance in the tree's primitive order
+	SceneCacheSection meshes;    // nMeshes SceneCacheMesh
+};
+
+//! A placed copy of a mesh (a CompositeObject)
+struct SceneCacheInstance {
+	Vector3 translation;
+	uint32_t mesh;
+};
+
+//! A shared mesh (a CompositeMesh): its bottom-level tree and its spheres in
+//! leaf order, as four SphereBatch arrays (x, y, z, squared radius) of
+//! sphereStride floats each, padding lanes included
+struct SceneCacheMesh {
+	BVHBounds bbox;
+	uint32_t nNodes, nSpheres;
+	SceneCacheSection nodes, spheres;
+	uint32_t sphereStride, reserved;
+};
+
+//! 64-bit hash of bytes, 8 at a time (FNV-1a on words, then a final mix).
+//! bytes must be a multiple of 8.
+uint64_t sceneCacheChecksum(const void *data, size_t bytes, uint64_t seed = 0xcbf29ce484222325ull);
+
+//! A built scene (BVH over CompositeObject instances) stored in one file and
+//! traced straight from its memory mapping
+//! - write() flattens the scene BVH, the instances in its primitive order and
+//!   every shared mesh's bottom-level BVH and spheres. All trees use the
+//!   32-byte BVHNodeFloat32 layout of BVHCompact.
+//! - open() maps the file and checks the header, the section bounds and every
+//!   index traversal follows (child links, leaf ranges, instance meshes): one
+//!   pass over the nodes and instances, no parsing or copying. Sphere pages
+//!   are read as traversal touches them. The checksum covers the whole file,
+//!   so it is only checked on request (verify); without it a damaged file
+//!   can render wrong, but cannot make traversal read outside the file.
+//! - Traversal repeats BVH + CompositeObject step by step, so images match
+//!   the live scene exactly
+//! - The cache is itself the one Object of every hit, and remembers the
+//!   instance in IntersectionInfo::instID for getNormal()
+class SceneCache : public Object {
+	const char *base;
+	size_t bytes;
+	bool mapped;
+	const SceneCacheHeader *header;
+	const BVHNodeFloat32 *nodes;
+	const SceneCacheInstance *instances;
+	const SceneCacheMesh *meshes;
+	std::vector<SphereBatch> spheres; // Views of each mesh's sphere arrays
+
+	void close();
+
+	//! True if section lies in the file, aligned, holding count elements of size bytes
+	bool validSection(const SceneCacheSection &section, uint64_t count, uint64_t size) const;
+
+	//! True if traverse() stays within tree: links lead to later nodes, leafs
+	//! to primitives below nPrims, and no path outgrows the traversal stack
+	static bool validTree(const BVHNodeFloat32 *tree, uint32_t nNodes, uint32_t nPrims);
+
+	//! Closest hit (any hit with occlusion) closer than intersection->t
+	bool traceScene(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	//! CompositeObject::getIntersection() for instance i
+	bool intersectInstance(uint32_t i, const Ray &ray, IntersectionInfo *intersection) const;
+
+	//! BVH::traverse() on a tree of BVHNodeFloat32, with leaf(start, nPrims, intersection)
+	template <typename LeafIntersector>
+	static bool traverse(const BVHNodeFloat32 *tree, const Ray &ray, IntersectionInfo *intersection, bool occlusion,
+						 const LeafIntersector &leaf);
+
+public:
+	SceneCache();
+
+	SceneCache(const SceneCache &) = delete;
+	SceneCache &operator=(const SceneCache &) = delete;
+
+	~SceneCache();
+
+	//! Store the scene of bvh, whose primitives must all be CompositeObjects
+	static bool write(const char *filename, const BVH &bvh, uint64_t sceneKey);
+
+	//! Map a file written for sceneKey. Returns false, leaving the cache empty,
+	//! if it is missing, stale, from another layout version or byte order, or
+	//! (with verify) corrupt.
+	bool open(const char *filename, uint64_t sceneKey, bool verify = false);
+
+	bool isOpen() const { return header != NULL; }
+
+	//! Recompute the checksum; touches every page of the file
+	bool verify() const;
+
+	uint32_t getNodeCount() const { return header ? header->nNodes : 0; }
+
+	uint32_t getInstanceCount() const { return header ? header->nInstances : 0; }
+
+	size_t getFileBytes() const { return bytes; }
+
+	//! As BVH::getIntersection
+	bool getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const;
+
+	bool getIntersection(const Ray &ray, IntersectionInfo *intersection) const override;
+
+	Vector3 getNormal(const IntersectionInfo &I) const override;
+
+	BBox getBBox() const override;
+
+	Vector3 getCentroid() const override;
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+static const char sceneCacheMagic[8] = {'H', 'W', '3', 'S', 'C', 'E', 'N', 'E'};
+
+uint64_t sceneCacheChecksum(const void *data, size_t bytes, uint64_t seed) {
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	uint64_t h = seed;
+	for (size_t i = 0; i + 8 <= bytes; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, 8);
+		h = (h ^ word) * 0x100000001b3ull;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint64_t sceneCacheAlign(uint64_t offset) {
+	return (offset + SceneCacheAlign - 1) / SceneCacheAlign * SceneCacheAlign;
+}
+
+SceneCache::SceneCache()
+		: base(NULL), bytes(0), mapped(false), header(NULL), nodes(NULL), instances(NULL), meshes(NULL) {}
+
+SceneCache::~SceneCache() {
+	close();
+}
+
+void SceneCache::close() {
+	spheres.clear();
+	if (base) {
+#if !defined(_WIN32)
+		if (mapped)
+			munmap(const_cast<char *>(base), bytes);
+		else
+#endif
+			::operator delete[](const_cast<char *>(base), std::align_val_t(SceneCacheAlign));
+	}
+	base = NULL;
+	bytes = 0;
+	mapped = false;
+	header = NULL;
+	nodes = NULL;
+	instances = NULL;
+	meshes = NULL;
+}
+
+/*! Layout: header, top-level nodes, instances, meshes, then each mesh's nodes
+ *  and sphere arrays, every section on a SceneCacheAlign boundary. The file
+ *  is assembled in memory (zeroed, so padding bytes are deterministic) and
+ *  written with one fwrite.
+ */
+bool SceneCache::write(const char *filename, const BVH &bvh, uint64_t sceneKey) {
+	const std::vector<Object *> &prims = bvh.getPrimitives();
+
+	// Instances in primitive order, meshes numbered as first met
+	std::vector<SceneCacheInstance> instanceList(prims.size());
+	std::vector<const CompositeMesh *> meshList;
+	std::map<const CompositeMesh *, uint32_t> meshIndex;
+	for (size_t i = 0; i < prims.size(); ++i) {
+		const CompositeObject *obj = dynamic_cast<const CompositeObject *>(prims[i]);
+		if (!obj) {
+			LOG_ERROR("Unable to cache %s: only scenes of CompositeObjects are supported", filename);
+			return false;
+		}
+		auto found = meshIndex.find(obj->getMesh());
+		if (found == meshIndex.end()) {
+			found = meshIndex.insert(std::make_pair(obj->getMesh(), (uint32_t) meshList.size())).first;
+			meshList.push_back(obj->getMesh());
+		}
+		instanceList[i].translation = obj->getTranslation();
+		instanceList[i].mesh = found->second;
+	}
+
+	SceneCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, sceneCacheMagic, sizeof(h.magic));
+	h.version = SceneCacheVersion;
+	h.byteOrder = SceneCacheByteOrder;
+	h.headerBytes = sizeof(SceneCacheHeader);
+	h.nodeBytes = sizeof(BVHNodeFloat32);
+	h.sceneKey = sceneKey;
+	h.nNodes = bvh.getNodeCount();
+	h.nInstances = (uint32_t) instanceList.size();
+	h.nMeshes = (uint32_t) meshList.size();
+
+	uint64_t offset = sceneCacheAlign(sizeof(SceneCacheHeader));
+	h.nodes.offset = offset;
+	h.nodes.bytes = (uint64_t) h.nNodes * sizeof(BVHNodeFloat32);
+	offset = sceneCacheAlign(offset + h.nodes.bytes);
+	h.instances.offset = offset;
+	h.instances.bytes = (uint64_t) h.nInstances * sizeof(SceneCacheInstance);
+	offset = sceneCacheAlign(offset + h.instances.bytes);
+	h.meshes.offset = offset;
+	h.meshes.bytes = (uint64_t) h.nMeshes * sizeof(SceneCacheMesh);
+	offset = sceneCacheAlign(offset + h.meshes.bytes);
+
+	std::vector<SceneCacheMesh> meshInfo(meshList.size());
+	for (size_t m = 0; m < meshList.size(); ++m) {
+		const CompositeMesh &mesh(*meshList[m]);
+		SceneCacheMesh &info(meshInfo[m]);
+		info.bbox.min = mesh.getBBox().min;
+		info.bbox.max = mesh.getBBox().max;
+		info.nNodes = mesh.getBLAS().getNodeCount();
+		info.nSpheres = mesh.getSphereCount();
+		info.nodes.offset = offset;
+		info.nodes.bytes = (uint64_t) info.nNodes * sizeof(BVHNodeFloat32);
+		offset = sceneCacheAlign(offset + info.nodes.bytes);
+
+		// As SphereBatch::reserve(): a multiple of 8 lanes plus a padding vector
+		info.sphereStride = ((info.nSpheres + 7) & ~7u) + 8;
+		info.reserved = 0;
+		info.spheres.offset = offset;
+		info.spheres.bytes = 4ull * info.sphereStride * sizeof(float);
+		offset = sceneCacheAlign(offset + info.spheres.bytes);
+	}
+	h.fileBytes = offset;
+
+	std::vector<char> file(h.fileBytes, 0);
+	char *out = file.data();
+	BVHNodeFloat32 *nodeOut = reinterpret_cast<BVHNodeFloat32 *>(out + h.nodes.offset);
+	for (uint32_t n = 0; n < h.nNodes; ++n)
+		nodeOut[n] = compactNode(bvh.getFlatTree()[n]);
+	memcpy(out + h.instances.offset, instanceList.data(), h.instances.bytes);
+	memcpy(out + h.meshes.offset, meshInfo.data(), h.meshes.bytes);
+
+	for (size_t m = 0; m < meshList.size(); ++m) {
+		const CompositeMesh &mesh(*meshList[m]);
+		const SceneCacheMesh &info(meshInfo[m]);
+		nodeOut = reinterpret_cast<BVHNodeFloat32 *>(out + info.nodes.offset);
+		for (uint32_t n = 0; n < info.nNodes; ++n)
+			nodeOut[n] = compactNode(mesh.getBLAS().getFlatTree()[n]);
+
+		// Padding lanes as in SphereBatch: a degenerate sphere far away, never hit
+		float *sx = reinterpret_cast<float *>(out + info.spheres.offset);
+		float *sy = sx + info.sphereStride, *sz = sy + info.sphereStride, *sr2 = sz + info.sphereStride;
+		std::fill(sx, sr2, 1e30f);
+		std::fill(sr2, sr2 + info.sphereStride, -1.f);
+		const SphereBatch &batch(mesh.getSpheres());
+		for (uint32_t s = 0; s < info.nSpheres; ++s) {
+			Vector3 c = batch.center(s);
+			sx[s] = c.x;
+			sy[s] = c.y;
+			sz[s] = c.z;
+			sr2[s] = batch.radius2(s);
+		}
+	}
+
+	h.checksum = sceneCacheChecksum(out + h.headerBytes, h.fileBytes - h.headerBytes);
+	memcpy(out, &h, sizeof(h));
+
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		LOG_ERROR("Unable to open %s", filename);
+		return false;
+	}
+	bool ok = fwrite(out, 1, file.size(), f) == file.size();
+	ok &= fclose(f) == 0;
+	if (!ok)
+		LOG_ERROR("Unable to write %s", filename);
+	return ok;
+}
+
+bool SceneCache::validSection(const SceneCacheSection &section, uint64_t count, uint64_t size) const {
+	return section.offset % SceneCacheAlign == 0 && section.offset <= bytes && section.bytes <= bytes - section.offset &&
+		   section.bytes == count * size;
+}
+
+bool SceneCache::validTree(const BVHNodeFloat32 *tree, uint32_t nNodes, uint32_t nPrims) {
+	// Children always follow their parent, so one forward pass sees every
+	// node's depth before the node itself
+	std::vector<uint8_t> depth(nNodes, 0);
+	for (uint32_t ni = 0; ni < nNodes; ++ni) {
+		const BVHNodeFloat32 &node(tree[ni]);
+		if (node.count > 0) {
+			if ((uint64_t) node.link + node.count > nPrims)
+				return false;
+			continue;
+		}
+		// At most one pending sibling per level, plus the node being popped
+		if (node.link < 2 || node.link >= nNodes - ni || depth[ni] >= 62)
+			return false;
+		depth[ni + 1] = std::max<uint8_t>(depth[ni + 1], depth[ni] + 1);
+		depth[ni + node.link] = std::max<uint8_t>(depth[ni + node.link], depth[ni] + 1);
+	}
+	return true;
+}
+
+bool SceneCache::open(const char *filename, uint64_t sceneKey, bool verifyChecksum) {
+	close();
+
+#if !defined(_WIN32)
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SceneCacheHeader)) {
+		::close(fd);
+		LOG_WARNING("Ignoring %s: not a scene cache", filename);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		LOG_ERROR("Unable to map %s", filename);
+		return false;
+	}
+	base = static_cast<const char *>(map);
+	bytes = st.st_size;
+	mapped = true;
+#else
+	// No mmap: one read into an aligned buffer, still used in place
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < (long) sizeof(SceneCacheHeader)) {
+		fclose(f);
+		LOG_WARNING("Ignoring %s: not a scene cache", filename);
+		return false;
+	}
+	char *buffer = static_cast<char *>(::operator new[](size, std::align_val_t(SceneCacheAlign)));
+	base = buffer;
+	bytes = size;
+	bool read = fread(buffer, 1, size, f) == (size_t) size;
+	fclose(f);
+	if (!read) {
+		LOG_ERROR("Unable to read %s", filename);
+		close();
+		return false;
+	}
+#endif
+
+	const SceneCacheHeader *h = reinterpret_cast<const SceneCacheHeader *>(base);
+	const char *problem = NULL;
+	if (memcmp(h->magic, sceneCacheMagic, sizeof(h->magic)) != 0)
+		problem = "not a scene cache";
+	else if (h->byteOrder != SceneCacheByteOrder)
+		problem = "written with another byte order";
+	else if (h->version != SceneCacheVersion || h->headerBytes != sizeof(SceneCacheHeader) ||
+			 h->nodeBytes != sizeof(BVHNodeFloat32))
+		problem = "written for another layout version";
+	else if (h->fileBytes != bytes)
+		problem = "truncated";
+	else if (h->sceneKey != sceneKey)
+		problem = "made for another scene";
+	else if (h->nNodes == 0 || !validSection(h->nodes, h->nNodes, sizeof(BVHNodeFloat32)) ||
+			 !validSection(h->instances, h->nInstances, sizeof(SceneCacheInstance)) ||
+			 !validSection(h->meshes, h->nMeshes, sizeof(SceneCacheMesh)))
+		problem = "damaged";
+	else if (verifyChecksum && sceneCacheChecksum(base + h->headerBytes, bytes - h->headerBytes) != h->checksum)
+		problem = "checksum mismatch";
+
+	const SceneCacheMesh *m = reinterpret_cast<const SceneCacheMesh *>(base + h->meshes.offset);
+	for (uint32_t i = 0; !problem && i < h->nMeshes; ++i) {
+		if (m[i].nNodes == 0 || m[i].sphereStride < m[i].nSpheres + 8 || m[i].sphereStride % 8 ||
+			!validSection(m[i].nodes, m[i].nNodes, sizeof(BVHNodeFloat32)) ||
+			!validSection(m[i].spheres, 4ull * m[i].sphereStride, sizeof(float)) ||
+			!validTree(reinterpret_cast<const BVHNodeFloat32 *>(base + m[i].nodes.offset), m[i].nNodes, m[i].nSpheres))
+			problem = "damaged";
+	}
+
+	// Every index the top-level traversal follows
+	if (!problem && !validTree(reinterpret_cast<const BVHNodeFloat32 *>(base + h->nodes.offset), h->nNodes,
+							   h->nInstances))
+		problem = "damaged";
+	const SceneCacheInstance *inst = reinterpret_cast<const SceneCacheInstance *>(base + h->instances.offset);
+	for (uint32_t i = 0; !problem && i < h->nInstances; ++i) {
+		if (inst[i].mesh >= h->nMeshes)
+			problem = "damaged";
+	}
+
+	if (problem) {
+		LOG_WARNING("Ignoring %s: %s", filename, problem);
+		close();
+		return false;
+	}
+
+	header = h;
+	nodes = reinterpret_cast<const BVHNodeFloat32 *>(base + h->nodes.offset);
+	instances = reinterpret_cast<const SceneCacheInstance *>(base + h->instances.offset);
+	meshes = m;
+	spheres = std::vector<SphereBatch>(h->nMeshes);
+	for (uint32_t i = 0; i < h->nMeshes; ++i) {
+		const float *s = reinterpret_cast<const float *>(base + m[i].spheres.offset);
+		const uint32_t stride = m[i].sphereStride;
+		spheres[i].view(s, s + stride, s + 2 * stride, s + 3 * stride, m[i].nSpheres);
+	}
+	return true;
+}
+
+bool SceneCache::verify() const {
+	return header && sceneCacheChecksum(base + header->headerBytes, bytes - header->headerBytes) == header->checksum;
+}
+
+template <typename LeafIntersector>
+bool SceneCache::traverse(const BVHNodeFloat32 *tree, const Ray &ray, IntersectionInfo *intersection, bool occlusion,
+						  const LeafIntersector &leaf) {
+	bool found = false;
+	float bbhits[4];
+
+	// Working set
+	BVHTraversal todo[64];
+	int32_t stackptr = 0;
+	todo[stackptr] = BVHTraversal(0, -9999999.f);
+
+	while (stackptr >= 0) {
+		// Pop off the next node to work on.
+		uint32_t ni = todo[stackptr].i;
+		float near = todo[stackptr].mint;
+		stackptr--;
+		const BVHNodeFloat32 &node(tree[ni]);
+
+		// If this node is further than the closest found intersection, continue
+		if (near > intersection->t)
+			continue;
+
+		// Is leaf -> Intersect
+		if (node.count > 0) {
+			bool hit = leaf(node.link, node.count, intersection);
+			found |= hit;
+
+			// If we're only looking for occlusion, then any hit is good enough
+			if (occlusion && hit)
+				return true;
+			continue;
+		}
+
+		bool hitc0 = intersectBounds(tree[ni + 1].bounds, ray, bbhits, bbhits + 1);
+		bool hitc1 = intersectBounds(tree[ni + node.link].bounds, ray, bbhits + 2, bbhits + 3);
+
+		// Push the farther first, so the closer is popped next
+		if (hitc0 && hitc1) {
+			if (bbhits[2] < bbhits[0]) {
+				todo[++stackptr] = BVHTraversal(ni + 1, bbhits[0]);
+				todo[++stackptr] = BVHTraversal(ni + node.link, bbhits[2]);
+			} else {
+				todo[++stackptr] = BVHTraversal(ni + node.link, bbhits[2]);
+				todo[++stackptr] = BVHTraversal(ni + 1, bbhits[0]);
+			}
+		} else if (hitc0) {
+			todo[++stackptr] = BVHTraversal(ni + 1, bbhits[0]);
+		} else if (hitc1) {
+			todo[++stackptr] = BVHTraversal(ni + node.link, bbhits[2]);
+		}
+	}
+
+	return found;
+}
+
+bool SceneCache::intersectInstance(uint32_t i, const Ray &ray, IntersectionInfo *intersection) const {
+	const SceneCacheInstance &inst(instances[i]);
+	const SceneCacheMesh &mesh(meshes[inst.mesh]);
+
+	// The instance's world box first, as CompositeObject does
+	BVHBounds box;
+	box.min = mesh.bbox.min + inst.translation;
+	box.max = mesh.bbox.max + inst.translation;
+	float tmin, tmax;
+	if (!intersectBounds(box, ray, &tmin, &tmax) || tmin > intersection->t)
+		return false;
+
+	// Then the shared mesh in object space, spheres tested as a SphereBatch
+	Ray localRay(ray.o - inst.translation, ray.d, ray.inv_d);
+	const SphereBatch &batch(spheres[inst.mesh]);
+	const BVHNodeFloat32 *tree = reinterpret_cast<const BVHNodeFloat32 *>(base + mesh.nodes.offset);
+	bool hit = traverse(tree, localRay, intersection, false,
+						[&batch, &localRay](uint32_t start, uint32_t nPrims, IntersectionInfo *I) {
+							float t;
+							int32_t part = batch.intersect(localRay, start, start + nPrims, I->t, &t);
+							if (part < 0)
+								return false;
+							I->t = t;
+							I->primID = (uint32_t) part;
+							return true;
+						});
+	if (!hit)
+		return false;
+
+	intersection->object = this;
+	intersection->instID = i;
+	return true;
+}
+
+bool SceneCache::getIntersection(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	intersection->t = 999999999.f;
+	intersection->object = NULL;
+
+	traceScene(ray, intersection, occlusion);
+
+	// If we hit something,
+	if (intersection->object != NULL)
+		intersection->hit = ray.o + ray.d * intersection->t;
+
+	return intersection->object != NULL;
+}
+
+bool SceneCache::getIntersection(const Ray &ray, IntersectionInfo *intersection) const {
+	return traceScene(ray, intersection, false);
+}
+
+bool SceneCache::traceScene(const Ray &ray, IntersectionInfo *intersection, bool occlusion) const {
+	return header && traverse(nodes, ray, intersection, occlusion,
+							  [this, &ray](uint32_t start, uint32_t nPrims, IntersectionInfo *I) {
+								  bool found = false;
+								  for (uint32_t o = 0; o < nPrims; ++o)
+									  found |= intersectInstance(start + o, ray, I);
+								  return found;
+							  });
+}
+
+Vector3 SceneCache::getNormal(const IntersectionInfo &I) const {
+	const SceneCacheInstance &inst(instances[I.instID]);
+	return normalize(I.hit - inst.translation - spheres[inst.mesh].center(I.primID));
+}
+
+BBox SceneCache::getBBox() const {
+	if (!header)
+		return BBox(Vector3(0, 0, 0));
+	return BBox(nodes[0].bounds.min, nodes[0].bounds.max);
+}
+
+Vector3 SceneCache::getCentroid() const {
+	BBox box = getBBox();
+	return (box.min + box.max) * .5f;
+}
+
+#endif
@@ -26,9 +26,19 @@ public:
 		if (disc < 0.f)
 			return false;
 
-		// Assume we are not in a sphere... The first hit is the lesser valued
+		// The first hit is the lesser valued, unless we are inside the sphere
+		float root = sqrt(disc);
+		float t = sd - root;
+		if (!(t > 0.f))
+			t = sd + root;
+
+		// Behind the ray, or not closer than what we already have
+		if (!(t > 0.f) || !(t < I->t))
+			return false;
+
 		I->object = this;
-		I->t = sd - sqrt(disc);
+		I->t = t;
+		I->primID = 0;
 		return true;
 	}
 
@@ -46,6 +56,11 @@ public:
 	{
 		return center;
 	}
+
+	float getRadius() const
+	{
+		return r;
+	}
 };
 
 #endif
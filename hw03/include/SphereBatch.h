@@ -0,0 +1,272 @@
+#ifndef SphereBatch_h
+#define SphereBatch_h
+
+#include <stdint.h>
+#include <cmath>
+#include <new>
+#include <algorithm>
+#include "Vector3.h"
+#include "Ray.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! A set of spheres in SoA form: centers and squared radii in separate
+//! 32-byte aligned arrays, so one SIMD load fetches the same field of
+//! 4 (SSE) or 8 (AVX) spheres.
+//! - Arrays are padded, so a SIMD loop may read up to 8 lanes past the last
+//!   sphere of any range; lanes outside the range are masked out.
+//! - A batch can also view arrays it doesn't own (see view()); capacity is 0
+//!   then, and nothing is freed
+class SphereBatch {
+	float *cx, *cy, *cz, *r2;
+	uint32_t count, capacity;
+
+	void reserve(uint32_t n);
+
+	void release();
+
+public:
+	SphereBatch();
+
+	SphereBatch(const SphereBatch &) = delete;
+	SphereBatch &operator=(const SphereBatch &) = delete;
+
+	~SphereBatch();
+
+	void add(const Vector3 &center, float radius);
+
+	void clear() { count = 0; }
+
+	//! Use n spheres in existing arrays, laid out like the batch's own
+	//! (including the padding lanes), without copying; e.g. a memory-mapped
+	//! file. The arrays must outlive the batch; add() copies them first.
+	void view(const float *x, const float *y, const float *z, const float *radius2, uint32_t n);
+
+	uint32_t size() const { return count; }
+
+	Vector3 center(uint32_t i) const { return Vector3(cx[i], cy[i], cz[i]); }
+
+	float radius(uint32_t i) const { return sqrtf(r2[i]); }
+
+	//! Squared radius as stored, exact where radius() may round
+	float radius2(uint32_t i) const { return r2[i]; }
+
+	//! Nearest hit of the ray in front of its origin and closer than tmax among
+	//! spheres [begin, end). Returns the sphere index and writes *tHit, or -1.
+	int32_t intersect(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const;
+
+	//! One sphere at a time; the fallback for targets without SSE, and the
+	//! reference for the SIMD kernels
+	int32_t intersectScalar(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const;
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+SphereBatch::SphereBatch()
+		: cx(NULL), cy(NULL), cz(NULL), r2(NULL), count(0), capacity(0) {}
+
+SphereBatch::~SphereBatch() {
+	release();
+}
+
+void SphereBatch::release() {
+	if (capacity == 0)
+		return;
+	float *arrays[4] = {cx, cy, cz, r2};
+	for (float *a : arrays)
+		::operator delete[](a, std::align_val_t(32));
+	cx = cy = cz = r2 = NULL;
+	capacity = 0;
+}
+
+void SphereBatch::view(const float *x, const float *y, const float *z, const float *radius2, uint32_t n) {
+	release();
+	cx = const_cast<float *>(x);
+	cy = const_cast<float *>(y);
+	cz = const_cast<float *>(z);
+	r2 = const_cast<float *>(radius2);
+	count = n;
+}
+
+void SphereBatch::reserve(uint32_t n) {
+	if (n <= capacity)
+		return;
+	uint32_t newCapacity = std::max(n, 2 * capacity);
+	newCapacity = (newCapacity + 7) & ~7u;
+
+	float **arrays[4] = {&cx, &cy, &cz, &r2};
+	for (float **a : arrays) {
+		// One extra vector of padding, so a range starting anywhere can be read 8 lanes at a time
+		float *grown = static_cast<float *>(::operator new[]((newCapacity + 8) * sizeof(float), std::align_val_t(32)));
+		// Padding lanes: a degenerate sphere far away, never hit
+		std::fill(grown, grown + newCapacity + 8, a == &r2 ? -1.f : 1e30f);
+		if (*a)
+			std::copy(*a, *a + count, grown);
+		if (capacity)
+			::operator delete[](*a, std::align_val_t(32));
+		*a = grown;
+	}
+	capacity = newCapacity;
+}
+
+void SphereBatch::add(const Vector3 &center, float radius) {
+	reserve(count + 1);
+	cx[count] = center.x;
+	cy[count] = center.y;
+	cz[count] = center.z;
+	r2[count] = radius * radius;
+	count++;
+}
+
+//! Same math as Sphere::getIntersection
+int32_t SphereBatch::intersectScalar(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const {
+	int32_t best = -1;
+	for (uint32_t i = begin; i < end; ++i) {
+		Vector3 s(cx[i] - ray.o.x, cy[i] - ray.o.y, cz[i] - ray.o.z);
+		float sd = s * ray.d;
+		float ss = s * s;
+
+		// Compute discriminant
+		float disc = sd * sd - ss + r2[i];
+		if (disc < 0.f)
+			continue;
+
+		// The first hit is the lesser valued, unless we are inside the sphere
+		float root = sqrtf(disc);
+		float t = sd - root;
+		if (!(t > 0.f))
+			t = sd + root;
+
+		if (t > 0.f && t < tmax) {
+			tmax = t;
+			best = (int32_t) i;
+		}
+	}
+	if (best >= 0)
+		*tHit = tmax;
+	return best;
+}
+
+#if defined(__AVX__)
+
+int32_t SphereBatch::intersect(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const {
+	const __m256 ox = _mm256_set1_ps(ray.o.x), oy = _mm256_set1_ps(ray.o.y), oz = _mm256_set1_ps(ray.o.z);
+	const __m256 dx = _mm256_set1_ps(ray.d.x), dy = _mm256_set1_ps(ray.d.y), dz = _mm256_set1_ps(ray.d.z);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 last = _mm256_set1_ps((float) end);
+
+	// Per lane: the closest t so far and the index it came from (indices stay exact as floats)
+	__m256 bestT = _mm256_set1_ps(tmax);
+	__m256 bestIdx = _mm256_set1_ps(-1.f);
+	__m256 idx = _mm256_add_ps(_mm256_set1_ps((float) begin), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+
+	for (uint32_t i = begin; i < end; i += 8) {
+		__m256 sx = _mm256_sub_ps(_mm256_loadu_ps(cx + i), ox);
+		__m256 sy = _mm256_sub_ps(_mm256_loadu_ps(cy + i), oy);
+		__m256 sz = _mm256_sub_ps(_mm256_loadu_ps(cz + i), oz);
+
+		__m256 sd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, dx), _mm256_mul_ps(sy, dy)), _mm256_mul_ps(sz, dz));
+		__m256 ss = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, sx), _mm256_mul_ps(sy, sy)), _mm256_mul_ps(sz, sz));
+		__m256 disc = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(sd, sd), ss), _mm256_loadu_ps(r2 + i));
+
+		__m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+		__m256 tNear = _mm256_sub_ps(sd, root);
+		__m256 t = _mm256_blendv_ps(_mm256_add_ps(sd, root), tNear, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, bestT, _CMP_LT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(idx, last, _CMP_LT_OQ));
+
+		bestT = _mm256_blendv_ps(bestT, t, hit);
+		bestIdx = _mm256_blendv_ps(bestIdx, idx, hit);
+		idx = _mm256_add_ps(idx, _mm256_set1_ps(8.f));
+	}
+
+	float lt[8], li[8];
+	_mm256_storeu_ps(lt, bestT);
+	_mm256_storeu_ps(li, bestIdx);
+	int32_t best = -1;
+	for (uint32_t l = 0; l < 8; ++l) {
+		if (li[l] >= 0.f && (lt[l] < tmax || (lt[l] == tmax && (int32_t) li[l] < best))) {
+			tmax = lt[l];
+			best = (int32_t) li[l];
+		}
+	}
+	if (best >= 0)
+		*tHit = tmax;
+	return best;
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+//! Lane-wise a ? b : c
+static inline __m128 sphereBatchSelect(__m128 a, __m128 b, __m128 c) {
+	return _mm_or_ps(_mm_and_ps(a, b), _mm_andnot_ps(a, c));
+}
+
+int32_t SphereBatch::intersect(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const {
+	const __m128 ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z);
+	const __m128 dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y), dz = _mm_set1_ps(ray.d.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 last = _mm_set1_ps((float) end);
+
+	// Per lane: the closest t so far and the index it came from (indices stay exact as floats)
+	__m128 bestT = _mm_set1_ps(tmax);
+	__m128 bestIdx = _mm_set1_ps(-1.f);
+	__m128 idx = _mm_add_ps(_mm_set1_ps((float) begin), _mm_setr_ps(0, 1, 2, 3));
+
+	for (uint32_t i = begin; i < end; i += 4) {
+		__m128 sx = _mm_sub_ps(_mm_loadu_ps(cx + i), ox);
+		__m128 sy = _mm_sub_ps(_mm_loadu_ps(cy + i), oy);
+		__m128 sz = _mm_sub_ps(_mm_loadu_ps(cz + i), oz);
+
+		__m128 sd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, dx), _mm_mul_ps(sy, dy)), _mm_mul_ps(sz, dz));
+		__m128 ss = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy)), _mm_mul_ps(sz, sz));
+		__m128 disc = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(sd, sd), ss), _mm_loadu_ps(r2 + i));
+
+		__m128 root = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+		__m128 tNear = _mm_sub_ps(sd, root);
+		__m128 t = sphereBatchSelect(_mm_cmpgt_ps(tNear, zero), tNear, _mm_add_ps(sd, root));
+
+		__m128 hit = _mm_and_ps(_mm_cmpge_ps(disc, zero), _mm_cmpgt_ps(t, zero));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, bestT));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(idx, last));
+
+		bestT = sphereBatchSelect(hit, t, bestT);
+		bestIdx = sphereBatchSelect(hit, idx, bestIdx);
+		idx = _mm_add_ps(idx, _mm_set1_ps(4.f));
+	}
+
+	float lt[4], li[4];
+	_mm_storeu_ps(lt, bestT);
+	_mm_storeu_ps(li, bestIdx);
+	int32_t best = -1;
+	for (uint32_t l = 0; l < 4; ++l) {
+		if (li[l] >= 0.f && (lt[l] < tmax || (lt[l] == tmax && (int32_t) li[l] < best))) {
+			tmax = lt[l];
+			best = (int32_t) li[l];
+		}
+	}
+	if (best >= 0)
+		*tHit = tmax;
+	return best;
+}
+
+#else
+
+int32_t SphereBatch::intersect(const Ray &ray, uint32_t begin, uint32_t end, float tmax, float *tHit) const {
+	return intersectScalar(ray, begin, end, tmax, tHit);
+}
+
+#endif
+
+#endif
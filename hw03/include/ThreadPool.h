@@ -0,0 +1,169 @@
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! A work-stealing thread pool
+//! - Every participant owns a task deque. Owners pop from the front, idle
+//!   participants steal from the back of the others.
+//! - The thread calling wait() takes part in the work as the last participant,
+//!   so a pool of size 1 spawns no thread and runs everything serially.
+class ThreadPool {
+	struct WorkQueue {
+		std::mutex lock;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+
+	std::mutex stateLock;
+	std::condition_variable wakeCond, doneCond;
+	uint32_t queued;            // Submitted, not yet picked up (guarded by stateLock)
+	std::atomic<uint32_t> pending; // Submitted, not yet finished
+	uint32_t nextQueue;
+	bool stop;
+
+	bool pop(uint32_t id, std::function<void()> &task);
+
+	bool steal(uint32_t id, std::function<void()> &task);
+
+	//! Take a task from our own queue or steal one, and run it
+	bool runOne(uint32_t id);
+
+	void workerLoop(uint32_t id);
+
+public:
+	//! nThreads == 0 means one participant per hardware thread
+	explicit ThreadPool(uint32_t nThreads = 0);
+
+	~ThreadPool();
+
+	uint32_t size() const { return (uint32_t) queues.size(); }
+
+	//! Queue a task on the given participant (round-robin when queue == -1)
+	void submit(const std::function<void()> &task, int32_t queue = -1);
+
+	//! Help running tasks until every submitted task has finished
+	void wait();
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+ThreadPool::ThreadPool(uint32_t nThreads)
+		: queued(0), pending(0), nextQueue(0), stop(false) {
+	if (nThreads == 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (uint32_t i = 0; i < nThreads; ++i)
+		queues.emplace_back(new WorkQueue());
+
+	// The last queue belongs to the thread calling wait()
+	for (uint32_t i = 0; i + 1 < nThreads; ++i)
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		stop = true;
+	}
+	wakeCond.notify_all();
+	for (std::thread &t : workers)
+		t.join();
+}
+
+void ThreadPool::submit(const std::function<void()> &task, int32_t queue) {
+	uint32_t q = queue < 0 ? nextQueue++ % size() : (uint32_t) queue % size();
+	pending++;
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		queued++;
+	}
+	{
+		std::lock_guard<std::mutex> guard(queues[q]->lock);
+		queues[q]->tasks.push_back(task);
+	}
+	wakeCond.notify_one();
+}
+
+bool ThreadPool::pop(uint32_t id, std::function<void()> &task) {
+	WorkQueue &q(*queues[id]);
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.tasks.empty())
+		return false;
+	task = std::move(q.tasks.front());
+	q.tasks.pop_front();
+	return true;
+}
+
+bool ThreadPool::steal(uint32_t id, std::function<void()> &task) {
+	for (uint32_t k = 1; k < size(); ++k) {
+		WorkQueue &q(*queues[(id + k) % size()]);
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (q.tasks.empty())
+			continue;
+		task = std::move(q.tasks.back());
+		q.tasks.pop_back();
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::runOne(uint32_t id) {
+	std::function<void()> task;
+	if (!pop(id, task) && !steal(id, task))
+		return false;
+
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		queued--;
+	}
+	task();
+
+	if (--pending == 0) {
+		std::lock_guard<std::mutex> guard(stateLock);
+		doneCond.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::workerLoop(uint32_t id) {
+	for (;;) {
+		if (runOne(id))
+			continue;
+
+		std::unique_lock<std::mutex> lk(stateLock);
+		wakeCond.wait(lk, [this] { return stop || queued > 0; });
+		if (stop && queued == 0)
+			return;
+	}
+}
+
+void ThreadPool::wait() {
+	const uint32_t id = size() - 1;
+	while (pending > 0) {
+		if (runOne(id))
+			continue;
+
+		// Nothing left to steal: sleep until the stragglers finish
+		std::unique_lock<std::mutex> lk(stateLock);
+		doneCond.wait(lk, [this] { return pending == 0 || queued > 0; });
+	}
+}
+
+#endif
@@ -1,14 +1,20 @@
 #include <cstdio>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <fstream>
 #include "BVH.h"
-#include "Doraemon.h"
-#include "Pikachu.h"
+#include "BVH4.h"
+#include "BVHCompact.h"
+#include "SceneCache.h"
+#include "ImageWriter.h"
+#include "RandomScene.h"
+#include "Renderer.h"
+#include "ThreadPool.h"
 #include "Vector3.h"
 
 using std::vector;
@@ -18,133 +24,246 @@ using namespace std;
 // Save results
 struct ExperimentResult
 {
+	const char *accel;
 	int scene;
 	int objectCount;
+	int threads;
 	double buildTime;
 	double renderTime;
 };
 
-// Return a random number in [0,1]
-float rand01()
+// Compact nodes against the binary BVH they were encoded from, same scene
+struct CompactResult
 {
-	return rand() * (1.f / RAND_MAX);
+	const char *format;
+	int scene;
+	int objectCount;
+	size_t binaryBytes;
+	size_t compactBytes;
+	double binaryRenderTime;
+	double compactRenderTime;
+};
+
+// Traversal structure used for rendering
+enum AccelType
+{
+	AccelBinary, // BVH as built
+	AccelBVH4,   // BVH collapsed to a 4-wide SIMD tree
+	AccelPacket, // BVH as built, primary rays traced in 8-ray packets
+	AccelCompact // BVH re-encoded into 32-byte or quantized nodes
+};
+
+const char *accelName(AccelType accel)
+{
+	return accel == AccelBVH4 ? "BVH4" : accel == AccelPacket ? "Packet" : accel == AccelCompact ? "Compact" : "Binary";
 }
 
-// Return a random vector with each component in the range [-1,1]
-Vector3 randVector3()
+// Options selected on the command line
+struct RenderSettings
+{
+	BVHBuildOptions buildOptions;
+	AccelType accel;
+	BVHNodeFormat nodeFormat;
+	int tileSize;
+	ImageWriteMode outputMode;
+	bool asyncOutput;
+	bool useCache;    // Map scenes saved by an earlier run, save the others
+	bool verifyCache; // Check the checksum of mapped scenes
+};
+
+// Hash of a mesh's geometry in leaf order (which its bottom-level tree decides)
+uint64_t meshKey(const CompositeMesh *mesh, uint64_t seed)
+{
+	const SphereBatch &spheres(mesh->getSpheres());
+	const BBox &box(mesh->getBBox());
+	vector<float> values = {box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z};
+	for (uint32_t s = 0; s < spheres.size(); ++s)
+	{
+		Vector3 c = spheres.center(s);
+		values.insert(values.end(), {c.x, c.y, c.z, spheres.radius2(s)});
+	}
+	uint64_t count = spheres.size();
+	seed = sceneCacheChecksum(&count, sizeof(count), seed);
+	return sceneCacheChecksum(values.data(), values.size() * sizeof(float), seed); // 6 + 4n floats, whole words
+}
+
+// Seed of the one rand() stream every scene is drawn from
+const unsigned sceneSeed = 12345;
+
+// Every scene comes from the rand() stream seeded with sceneSeed in main(), so
+// it is identified by the seed, its size and where in the stream it starts; the
+// trees also depend on the build options, and the instances on the shared meshes
+uint64_t sceneKey(int N, int sceneScale, const BVHBuildOptions &options)
 {
-	return Vector3(rand01(), rand01(), rand01()) * 2.f - Vector3(1, 1, 1);
+	const BVHBuildOptions blas = CompositeMesh::blasOptions();
+	uint32_t costs[4];
+	memcpy(costs, &options.traversalCost, sizeof(float));
+	memcpy(costs + 1, &options.intersectionCost, sizeof(float));
+	memcpy(costs + 2, &blas.traversalCost, sizeof(float));
+	memcpy(costs + 3, &blas.intersectionCost, sizeof(float));
+	uint64_t fields[14] = {sceneSeed, (uint64_t)N, (uint64_t)sceneScale, randDraws, (uint64_t)options.splitMethod,
+						   options.leafSize, options.sahBins, options.mortonBits, (uint64_t)costs[0] << 32 | costs[1],
+						   (uint64_t)blas.splitMethod, blas.leafSize, blas.sahBins, blas.mortonBits,
+						   (uint64_t)costs[2] << 32 | costs[3]};
+	uint64_t key = sceneCacheChecksum(fields, sizeof(fields));
+	key = meshKey(sharedMesh<DoraemonMesh>(sceneObjectScale), key);
+	return meshKey(sharedMesh<PikachuMesh>(sceneObjectScale), key);
 }
 
-void Experiment(int N, int sceneScale, vector<ExperimentResult> &results)
+void Experiment(int N, int sceneScale, const RenderSettings &settings, ThreadPool &pool, AsyncImageWriter *writer,
+				vector<ExperimentResult> &results, vector<CompactResult> &compactResults)
 {
 	int width = 1024;
 	int height = 1024;
 
 	printf(">>> Running Experiment: Resolution %dx%d (Objects: %d) <<<\n", width, height, N);
 	vector<Object *> objects;
-
-	// Mix object
-	for (size_t i = 0; i < N; ++i)
+	BVH *bvh = NULL;
+	BVH4 *bvh4 = NULL;
+	BVHCompact *compact = NULL;
+
+	// A scene saved by an earlier run is mapped instead of generated and built
+	char cacheName[64];
+	sprintf(cacheName, "scene_Scale=%d_N=%d.cache", sceneScale, N);
+	const uint64_t key = sceneKey(N, sceneScale, settings.buildOptions);
+	SceneCache *cache = NULL;
+	std::chrono::duration<double> elapsed_build;
+	if (settings.useCache)
 	{
-		if (i % 2 == 0)
+		auto start_load = std::chrono::high_resolution_clock::now();
+		cache = new SceneCache;
+		if (cache->open(cacheName, key, settings.verifyCache))
 		{
-			objects.push_back(new Doraemon(randVector3() * (float)sceneScale, 0.01f));
+			elapsed_build = std::chrono::high_resolution_clock::now() - start_load;
+			printf("   [Time] Scene Cache Load: %.5f seconds (%s, %d KiB)\n", elapsed_build.count(), cacheName,
+				   (int)(cache->getFileBytes() / 1024));
+
+			// Use up the numbers the scene was made from, so later scenes stay the same
+			for (int i = 0; i < 3 * N; ++i)
+				rand01();
 		}
 		else
 		{
-			objects.push_back(new Pikachu(randVector3() * (float)sceneScale, 0.01f));
+			delete cache;
+			cache = NULL;
 		}
 	}
 
-	// BVH build time
-	auto start_BVH = std::chrono::high_resolution_clock::now();
+	if (!cache)
+	{
+		// Mix object (instances of the shared Doraemon/Pikachu geometry)
+		auto start_setup = std::chrono::high_resolution_clock::now();
+		randomScene(objects, N, (float)sceneScale);
+
+		std::chrono::duration<double> elapsed_setup = std::chrono::high_resolution_clock::now() - start_setup;
+		printf("   [Time] Scene Setup: %.5f seconds\n", elapsed_setup.count());
 
-	BVH bvh(&objects);
+		// BVH build time
+		auto start_BVH = std::chrono::high_resolution_clock::now();
 
-	auto end_BVH = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> elapsed_build = end_BVH - start_BVH;
-	printf("   [Time] BVH Construction: %.5f seconds\n", elapsed_build.count());
+		bvh = new BVH(&objects, settings.buildOptions);
+		bvh4 = settings.accel == AccelBVH4 ? new BVH4(*bvh) : NULL;
+		compact = settings.accel == AccelCompact ? new BVHCompact(*bvh, settings.nodeFormat) : NULL;
+
+		auto end_BVH = std::chrono::high_resolution_clock::now();
+		elapsed_build = end_BVH - start_BVH;
+		printf("   [Time] BVH Construction: %.5f seconds\n", elapsed_build.count());
+
+		if (settings.useCache)
+		{
+			auto start_save = std::chrono::high_resolution_clock::now();
+			if (SceneCache::write(cacheName, *bvh, key))
+			{
+				std::chrono::duration<double> elapsed_save = std::chrono::high_resolution_clock::now() - start_save;
+				printf("   [Cache] Saved to %s in %.5f seconds\n", cacheName, elapsed_save.count());
+			}
+		}
+	}
 
 	// Allocate space for some image pixels
-	float *pixels = new float[width * height * 3];
+	vector<float> pixels(width * height * 3);
 
 	// Create a camera from position and focus point
-	Vector3 camera_position(1.6, 1.3, 1.6);
-	Vector3 camera_focus(0, 0, 0);
-	Vector3 camera_up(0, 1, 0);
-
-	// Camera tangent space
-	Vector3 camera_dir = normalize(camera_focus - camera_position);
-	Vector3 camera_u = normalize(camera_dir ^ camera_up);
-	Vector3 camera_v = normalize(camera_u ^ camera_dir);
+	Camera camera(Vector3(1.6, 1.3, 1.6), Vector3(0, 0, 0), Vector3(0, 1, 0), width, height);
 
 	// Rendering time
-	printf("   [Rendering] %dx%d image...\n", width, height);
+	printf("   [Rendering] %dx%d image on %d threads...\n", width, height, (int)pool.size());
 	auto start_render = std::chrono::high_resolution_clock::now();
 
-	// Raytrace over every pixel
-	for (size_t i = 0; i < width; ++i)
-	{
-		for (size_t j = 0; j < height; ++j)
-		{
-			size_t index = 3 * (width * j + i);
-
-			float u = (i + .5f) / (float)(width - 1) - .5f;
-			float v = (height - 1 - j + .5f) / (float)(height - 1) - .5f;
-			float fov = .5f / tanf(70.f * 3.14159265 * .5f / 180.f);
+	// Raytrace over every pixel, tile by tile
+	if (cache)
+		renderImage(*cache, camera, pixels.data(), pool, settings.tileSize);
+	else if (bvh4)
+		renderImage(*bvh4, camera, pixels.data(), pool, settings.tileSize);
+	else if (compact)
+		renderImage(*compact, camera, pixels.data(), pool, settings.tileSize);
+	else if (settings.accel == AccelPacket)
+		renderImagePackets(*bvh, camera, pixels.data(), pool, settings.tileSize);
+	else
+		renderImage(*bvh, camera, pixels.data(), pool, settings.tileSize);
 
-			// This is only valid for square aspect ratio images
-			Ray ray(camera_position, normalize(u * camera_u + v * camera_v + fov * camera_dir));
+	auto end_render = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> elapsed_render = end_render - start_render;
+	printf("   [Time] Rendering: %.5f seconds\n", elapsed_render.count());
 
-			IntersectionInfo I;
-			bool hit = bvh.getIntersection(ray, &I, false);
+	// Save results
+	results.push_back({cache ? "Cache" : accelName(settings.accel), sceneScale, N, (int)pool.size(), elapsed_build.count(), elapsed_render.count()});
 
-			if (!hit)
+	if (compact)
+	{
+		// Every layout encoded from the one binary BVH, each timed as the best of
+		// a few renders next to the binary BVH itself
+		const int rounds = 3;
+		vector<float> scratch(width * height * 3);
+		auto bestRender = [&](const auto &accel)
+		{
+			double best = 1e30;
+			for (int r = 0; r < rounds; ++r)
 			{
-				pixels[index] = pixels[index + 1] = pixels[index + 2] = 0.f;
+				auto start = std::chrono::high_resolution_clock::now();
+				renderImage(accel, camera, scratch.data(), pool, settings.tileSize);
+				std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+				best = std::min(best, elapsed.count());
 			}
-			else
-			{
-				// Just for fun, we'll make the color based on the normal
-				const Vector3 normal = I.object->getNormal(I);
-				const Vector3 color(fabs(normal.x), fabs(normal.y), fabs(normal.z));
+			return best;
+		};
 
-				pixels[index] = color.x;
-				pixels[index + 1] = color.y;
-				pixels[index + 2] = color.z;
-			}
+		const double binaryTime = bestRender(*bvh);
+		printf("   [Time] Rendering with the binary BVH: %.5f seconds (best of %d)\n", binaryTime, rounds);
+		const BVHNodeFormat formats[3] = {BVHNodeFloat, BVHNodeQuant16, BVHNodeQuant8};
+		for (BVHNodeFormat format : formats)
+		{
+			BVHCompact layout(*bvh, format);
+			const double layoutTime = bestRender(layout);
+			printf("   [Time] Rendering with %s nodes: %.5f seconds (best of %d)\n", nodeFormatName(format), layoutTime,
+				   rounds);
+			compactResults.push_back({nodeFormatName(format), sceneScale, N, bvh->getNodeCount() * sizeof(BVHFlatNode),
+									  layout.getMemoryBytes(), binaryTime, layoutTime});
 		}
 	}
 
-	auto end_render = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> elapsed_render = end_render - start_render;
-	printf("   [Time] Rendering: %.5f seconds\n", elapsed_render.count());
-
-	// Save results
-	results.push_back({sceneScale, N, elapsed_build.count(), elapsed_render.count()});
-
 	char filename[64];
 	sprintf(filename, "render_Scale=%d_N=%d.ppm", sceneScale, N);
 
-	FILE *image = fopen(filename, "wb");
-	fprintf(image, "P6\n%d %d\n255\n", width, height);
-	for (size_t j = 0; j < height; ++j)
+	if (writer)
 	{
-		for (size_t i = 0; i < width; ++i)
-		{
-			size_t index = 3 * (width * j + i);
-			unsigned char r = std::max(std::min(pixels[index] * 255.f, 255.f), 0.f);
-			unsigned char g = std::max(std::min(pixels[index + 1] * 255.f, 255.f), 0.f);
-			unsigned char b = std::max(std::min(pixels[index + 2] * 255.f, 255.f), 0.f);
-			fprintf(image, "%c%c%c", r, g, b);
-		}
+		// Saved on the writer thread while the next experiment runs
+		writer->submit(filename, width, height, std::move(pixels));
+		printf("   [Output] Saving to %s in the background\n", filename);
+	}
+	else
+	{
+		auto start_output = std::chrono::high_resolution_clock::now();
+		writePPM(filename, width, height, pixels.data(), settings.outputMode);
+		std::chrono::duration<double> elapsed_output = std::chrono::high_resolution_clock::now() - start_output;
+		printf("   [Output] Saved to %s in %.5f seconds\n", filename, elapsed_output.count());
 	}
-	fclose(image);
-	printf("   [Output] Saved to %s\n", filename);
 
 	// Cleanup
-	delete[] pixels;
+	delete bvh4;
+	delete compact;
+	delete bvh;
+	delete cache;
 	for (Object *obj : objects)
 		delete obj;
 	objects.clear();
@@ -154,9 +273,80 @@ void Experiment(int N, int sceneScale, vector<ExperimentResult> &results)
 
 int main(int argc, char **argv)
 {
-	srand(12345);
+	srand(sceneSeed);
+
+	// Command line: --split=midpoint|sah|lbvh --morton=30|63 --bvh=binary|bvh4|packet|compact --quantize=none|16|8
+	//               --threads=N --tile=N --cache --cache-verify
+	//               --output=buffered|mmap --async-output
+	RenderSettings settings;
+	settings.accel = AccelBinary;
+	settings.nodeFormat = BVHNodeFloat;
+	settings.tileSize = 32;
+	settings.outputMode = WriteBuffered;
+	settings.asyncOutput = false;
+	settings.useCache = false;
+	settings.verifyCache = false;
+	unsigned int threads = 0;
+	for (int a = 1; a < argc; ++a)
+	{
+		if (strcmp(argv[a], "--split=sah") == 0)
+			settings.buildOptions.splitMethod = SplitSAH;
+		else if (strcmp(argv[a], "--split=midpoint") == 0)
+			settings.buildOptions.splitMethod = SplitMidpoint;
+		else if (strcmp(argv[a], "--split=lbvh") == 0)
+			settings.buildOptions.splitMethod = SplitMorton;
+		else if (strcmp(argv[a], "--morton=30") == 0 || strcmp(argv[a], "--morton=63") == 0)
+			settings.buildOptions.mortonBits = atoi(argv[a] + 9);
+		else if (strcmp(argv[a], "--bvh=binary") == 0)
+			settings.accel = AccelBinary;
+		else if (strcmp(argv[a], "--bvh=bvh4") == 0)
+			settings.accel = AccelBVH4;
+		else if (strcmp(argv[a], "--bvh=packet") == 0)
+			settings.accel = AccelPacket;
+		else if (strcmp(argv[a], "--bvh=compact") == 0)
+			settings.accel = AccelCompact;
+		else if (strcmp(argv[a], "--quantize=none") == 0)
+			settings.nodeFormat = BVHNodeFloat;
+		else if (strcmp(argv[a], "--quantize=16") == 0)
+			settings.nodeFormat = BVHNodeQuant16;
+		else if (strcmp(argv[a], "--quantize=8") == 0)
+			settings.nodeFormat = BVHNodeQuant8;
+		else if (strncmp(argv[a], "--threads=", 10) == 0)
+			threads = atoi(argv[a] + 10);
+		else if (strncmp(argv[a], "--tile=", 7) == 0)
+			settings.tileSize = std::max(1, atoi(argv[a] + 7));
+		else if (strcmp(argv[a], "--output=buffered") == 0)
+			settings.outputMode = WriteBuffered;
+		else if (strcmp(argv[a], "--output=mmap") == 0)
+			settings.outputMode = WriteMapped;
+		else if (strcmp(argv[a], "--async-output") == 0)
+			settings.asyncOutput = true;
+		else if (strcmp(argv[a], "--cache") == 0)
+			settings.useCache = true;
+		else if (strcmp(argv[a], "--cache-verify") == 0)
+			settings.useCache = settings.verifyCache = true;
+		else
+			printf("[Warning] Unknown option %s\n", argv[a]);
+	}
+	// A mapped scene is traced as it is stored, never through the other structures
+	if (settings.useCache && settings.accel != AccelBinary)
+	{
+		printf("[Warning] --cache ignored: mapped scenes are only traced as a binary BVH, not %s\n",
+			   accelName(settings.accel));
+		settings.useCache = settings.verifyCache = false;
+	}
+	const BVHSplitMethod split = settings.buildOptions.splitMethod;
+	printf("BVH split method: %s, traversal: %s\n",
+		   split == SplitSAH ? "binned SAH" : split == SplitMorton ? (settings.buildOptions.mortonBits > 30 ? "LBVH (63-bit)" : "LBVH (30-bit)") : "midpoint",
+		   accelName(settings.accel));
+
+	// 0 threads means one per hardware thread; the LBVH builder shares the pool
+	ThreadPool pool(threads);
+	settings.buildOptions.pool = &pool;
+	AsyncImageWriter *writer = settings.asyncOutput ? new AsyncImageWriter(settings.outputMode) : NULL;
 
 	vector<ExperimentResult> results;
+	vector<CompactResult> compactResults;
 
 	vector<int> test_cases = {100, 500, 1000, 2000};
 	vector<float> scales = {1, 2, 4, 6};
@@ -167,22 +357,27 @@ int main(int argc, char **argv)
 	{
 		for (float s : scales)
 		{
-			Experiment(n, s, results);
+			Experiment(n, s, settings, pool, writer, results, compactResults);
 		}
 	}
 
+	// Wait for the last images to reach the disk
+	delete writer;
+
 	ofstream outFile("report.txt");
 
 	if (outFile.is_open())
 	{
-		outFile << "=============================================================================" << endl;
-		outFile << "                             Performance  Report                             " << endl;
-		outFile << "=============================================================================" << endl;
+		outFile << "=====================================================================================================" << endl;
+		outFile << "                                        Performance  Report                                        " << endl;
+		outFile << "=====================================================================================================" << endl;
 		outFile << "| " << left << setw(12) << "Scene Scale"
 				<< " | " << setw(10) << "Objects(N)"
+				<< " | " << setw(10) << "Threads"
+				<< " | " << setw(8) << "Accel"
 				<< " | " << setw(20) << "Build Time (s)"
 				<< " | " << setw(20) << "Render Time (s)" << " |" << endl;
-		outFile << "|--------------|------------|----------------------|----------------------|" << endl;
+		outFile << "|--------------|------------|------------|----------|----------------------|----------------------|" << endl;
 
 		for (const auto &res : results)
 		{
@@ -190,10 +385,45 @@ int main(int argc, char **argv)
 			sprintf(scaleStr, "%d", res.scene);
 			outFile << "| " << left << setw(12) << scaleStr
 					<< " | " << setw(10) << res.objectCount
+					<< " | " << setw(10) << res.threads
+					<< " | " << setw(8) << res.accel
 					<< " | " << setw(20) << fixed << setprecision(5) << res.buildTime
 					<< " | " << setw(20) << fixed << setprecision(5) << res.renderTime << " |" << endl;
 		}
-		outFile << "=============================================================================" << endl;
+		outFile << "=====================================================================================================" << endl;
+
+		// Node memory and render time of the compact nodes against the binary BVH
+		if (!compactResults.empty())
+		{
+			outFile << endl;
+			outFile << "========================================================================================================" << endl;
+			outFile << "                              Compact BVH Nodes (render times: best of 3)                               " << endl;
+			outFile << "========================================================================================================" << endl;
+			outFile << "| " << left << setw(12) << "Scene Scale"
+					<< " | " << setw(10) << "Objects(N)"
+					<< " | " << setw(8) << "Layout"
+					<< " | " << setw(10) << "Binary KiB"
+					<< " | " << setw(11) << "Compact KiB"
+					<< " | " << setw(10) << "Binary (s)"
+					<< " | " << setw(11) << "Compact (s)"
+					<< " | " << setw(7) << "Change" << " |" << endl;
+			outFile << "|--------------|------------|----------|------------|-------------|------------|-------------|---------|" << endl;
+
+			for (const auto &res : compactResults)
+			{
+				char changeStr[20];
+				sprintf(changeStr, "%+.1f%%", 100 * (res.compactRenderTime / res.binaryRenderTime - 1));
+				outFile << "| " << left << setw(12) << res.scene
+						<< " | " << setw(10) << res.objectCount
+						<< " | " << setw(8) << res.format
+						<< " | " << setw(10) << fixed << setprecision(1) << res.binaryBytes / 1024.0
+						<< " | " << setw(11) << fixed << setprecision(1) << res.compactBytes / 1024.0
+						<< " | " << setw(10) << fixed << setprecision(5) << res.binaryRenderTime
+						<< " | " << setw(11) << fixed << setprecision(5) << res.compactRenderTime
+						<< " | " << setw(7) << changeStr << " |" << endl;
+			}
+			outFile << "========================================================================================================" << endl;
+		}
 
 		printf("\n[Success] Report saved to \"report.txt\"\n");
 		outFile.close();
@@ -204,20 +434,22 @@ int main(int argc, char **argv)
 	}
 
 	printf("\n");
-	printf("=========================================================================\n");
-	printf("                       Performance  Report (Console)                     \n");
-	printf("=========================================================================\n");
-	printf("| %-12s | %-10s | %-20s | %-20s |\n", "Scene Scale", "Objects(N)", "Build Time (s)", "Render Time (s)");
-	printf("|--------------|------------|----------------------|----------------------|\n");
+	printf("=================================================================================================\n");
+	printf("                                  Performance  Report (Console)                                  \n");
+	printf("=================================================================================================\n");
+	printf("| %-12s | %-10s | %-10s | %-8s | %-20s | %-20s |\n", "Scene Scale", "Objects(N)", "Threads", "Accel", "Build Time (s)", "Render Time (s)");
+	printf("|--------------|------------|------------|----------|----------------------|----------------------|\n");
 
 	for (const auto &res : results)
 	{
 		cout << "| " << setw(12) << fixed << setprecision(1) << res.scene
 			 << " | " << setw(10) << res.objectCount
+			 << " | " << setw(10) << res.threads
+			 << " | " << setw(8) << res.accel
 			 << " | " << setw(20) << fixed << setprecision(5) << res.buildTime
 			 << " | " << setw(20) << fixed << setprecision(5) << res.renderTime << " |" << endl;
 	}
-	printf("=========================================================================\n");
+	printf("=================================================================================================\n");
 
 	printf("All tests finished.\n");
 
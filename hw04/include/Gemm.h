@@ -0,0 +1,565 @@
+#ifndef Gemm_h
+#define Gemm_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+#include "GemmKernels.h"
+#include "GemmSmall.h"
+#include "ThreadPool.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Storage order of all three matrices of one call
+enum GemmLayout
+{
+    GemmRowMajor,
+    GemmColMajor
+};
+
+//! Whether an operand is used as stored or transposed
+enum GemmTranspose
+{
+    GemmNoTrans,
+    GemmTrans
+};
+
+//! Cache blocking of the GotoBLAS-style loop nest
+//! - kc: depth of a packed panel; one MR x kc sliver of A plus one kc x NR sliver of B stay in L1
+//! - mc: rows of the packed A block, kept in L2
+//! - nc: columns of the packed B panel, kept in L3
+//! - tiles: tiles of C per participant on the parallel path, which sets the thread grid
+struct GemmBlocking
+{
+    int mc, kc, nc;
+    int tiles;
+};
+
+//! Blocking for the kernel's register tile and element size, derived from the
+//! cache sizes of this machine (fixed defaults where they can't be queried)
+template <typename T = double>
+GemmBlocking cacheBlocking(const GemmKernelT<T> &kernel = activeGemmKernel<T>());
+
+//! The blocking recorded with setTunedBlocking() for the kernel if there is one,
+//! else cacheBlocking()
+template <typename T = double>
+GemmBlocking defaultBlocking(const GemmKernelT<T> &kernel = activeGemmKernel<T>());
+
+//! Make defaultBlocking() return blocking for the named kernel of element type T
+//! (see GemmTune.h). mc and nc are rounded to whole register tiles. Not thread-safe:
+//! meant for startup, before any multiplication runs.
+template <typename T>
+void setTunedBlocking(const GemmKernelT<T> &kernel, const GemmBlocking &blocking);
+
+//! The blocking recorded for the named kernel of element type T, or NULL
+template <typename T>
+const GemmBlocking *tunedBlocking(const char *kernel);
+
+//! 64-byte aligned scratch buffer for packed panels of T
+template <typename T>
+class PackBuffer
+{
+    T *data;
+    size_t capacity;
+
+public:
+    PackBuffer() : data(NULL), capacity(0) {}
+    PackBuffer(const PackBuffer &) = delete;
+    PackBuffer &operator=(const PackBuffer &) = delete;
+    ~PackBuffer();
+
+    T *get(size_t count);
+};
+
+//! C = alpha * op(A) * op(B) + beta * C, with op(A) m x k, op(B) k x n and C m x n
+//! - lda, ldb, ldc are the leading dimensions of the matrices as stored
+//!   (row length for row-major, column length for column-major)
+//! - beta == 0 overwrites C without reading it
+//! - 4x4, 8x8 and 16x16 products of untransposed operands use the fully
+//!   unrolled kernels of GemmSmall.h; everything else the blocked path
+//! - With a pool of more than one thread the blocked path runs in parallel
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+          const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc, ThreadPool *pool = NULL);
+
+//! Single precision: twice the lanes per register and half the memory traffic,
+//! for about 7 significant digits. Sums run in float, so the error grows with k.
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, float alpha,
+          const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc, ThreadPool *pool = NULL);
+
+//! Mixed precision: float A and B, double C. Packing widens A and B to double, so
+//! the operands cost half the memory traffic while sums keep double accuracy;
+//! the only error beyond the double product is the rounding of the inputs.
+//! Always on the blocked path.
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+          const float *A, int lda, const float *B, int ldb, double beta, double *C, int ldc, ThreadPool *pool = NULL);
+
+//! Any of the above, always on the blocked path with the given kernel and blocking.
+//! In is the element type of A and B, T that of C and of the kernel.
+template <typename In, typename T>
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, T alpha,
+          const In *A, int lda, const In *B, int ldb, T beta, T *C, int ldc, ThreadPool *pool,
+          const GemmKernelT<T> &kernel, const GemmBlocking &blocking);
+
+//! C[m x n] = A[m x k] * B[k x n], all row-major with leading dimensions lda, ldb, ldc
+//! - Panels of B (kc x nc) and blocks of A (mc x kc) are copied into contiguous,
+//!   aligned buffers in the order the microkernel reads them
+//! - The microkernel keeps an MR x NR tile of C in registers for the whole kc loop;
+//!   partial tiles at the edges of C go through a small buffer
+void gemmBlocked(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                 const GemmKernel &kernel, const GemmBlocking &blocking);
+
+//! Same, with the active kernel and its default blocking
+void gemmBlocked(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc);
+
+//! gemmBlocked() on a thread pool, with 2D tiles of C
+//! - For each kc x nc step the participants pack the B panel and all of the A
+//!   slivers once, into buffers shared by everyone (nc is sized for L3, which
+//!   all cores of a socket share)
+//! - C is then cut into M x N tiles of whole register tiles, several per
+//!   participant, handed out as they finish; each tile only runs microkernels
+//! - Packing is split across the participants too, so it doesn't serialize the loop
+void gemmParallel(ThreadPool &pool, int m, int n, int k, const double *A, int lda, const double *B, int ldb,
+                  double *C, int ldc, const GemmKernel &kernel, const GemmBlocking &blocking);
+
+//! Same, with the active kernel and its default blocking
+void gemmParallel(ThreadPool &pool, int m, int n, int k, const double *A, int lda, const double *B, int ldb,
+                  double *C, int ldc);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+template <typename T>
+PackBuffer<T>::~PackBuffer()
+{
+    if (data)
+        ::operator delete[](data, std::align_val_t(64));
+}
+
+template <typename T>
+T *PackBuffer<T>::get(size_t count)
+{
+    if (count > capacity)
+    {
+        if (data)
+            ::operator delete[](data, std::align_val_t(64));
+        data = static_cast<T *>(::operator new[](count * sizeof(T), std::align_val_t(64)));
+        capacity = count;
+    }
+    return data;
+}
+
+#if defined(__linux__)
+static long cacheSize(int name, long fallback)
+{
+    long size = sysconf(name);
+    return size > 0 ? size : fallback;
+}
+#endif
+
+template <typename T>
+static std::vector<std::pair<std::string, GemmBlocking>> &tunedBlockings()
+{
+    static std::vector<std::pair<std::string, GemmBlocking>> tuned;
+    return tuned;
+}
+
+template <typename T>
+const GemmBlocking *tunedBlocking(const char *kernel)
+{
+    for (const auto &entry : tunedBlockings<T>())
+    {
+        if (entry.first == kernel)
+            return &entry.second;
+    }
+    return NULL;
+}
+
+template <typename T>
+void setTunedBlocking(const GemmKernelT<T> &kernel, const GemmBlocking &blocking)
+{
+    GemmBlocking b = blocking;
+    b.mc = std::max(1, b.mc / kernel.mr) * kernel.mr;
+    b.nc = std::max(1, b.nc / kernel.nr) * kernel.nr;
+    b.kc = std::max(1, b.kc);
+    b.tiles = std::max(1, b.tiles);
+
+    for (auto &entry : tunedBlockings<T>())
+    {
+        if (entry.first == kernel.name)
+        {
+            entry.second = b;
+            return;
+        }
+    }
+    tunedBlockings<T>().push_back(std::make_pair(std::string(kernel.name), b));
+}
+
+template <typename T>
+GemmBlocking cacheBlocking(const GemmKernelT<T> &kernel)
+{
+#if defined(__linux__)
+    // Queried once: small products call this on every multiplication
+    static const long l1 = cacheSize(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    static const long l2 = cacheSize(_SC_LEVEL2_CACHE_SIZE, 256 * 1024);
+    static const long l3 = cacheSize(_SC_LEVEL3_CACHE_SIZE, 8 * 1024 * 1024);
+#else
+    long l1 = 32 * 1024, l2 = 256 * 1024, l3 = 8 * 1024 * 1024;
+#endif
+
+    GemmBlocking b;
+    // Half of each level for the packed data, the rest for C and the other operand
+    long mr = kernel.mr, nr = kernel.nr;
+    b.kc = std::max(64L, std::min(512L, l1 / 2 / (nr * (long)sizeof(T))));
+    b.mc = std::max(mr, std::min(1024L, l2 / 2 / (b.kc * (long)sizeof(T))) / mr * mr);
+    b.nc = std::max(nr, std::min(8192L, l3 / 2 / (b.kc * (long)sizeof(T))) / nr * nr);
+    b.tiles = 4;
+    return b;
+}
+
+template <typename T>
+GemmBlocking defaultBlocking(const GemmKernelT<T> &kernel)
+{
+    if (const GemmBlocking *tuned = tunedBlocking<T>(kernel.name))
+        return *tuned;
+    return cacheBlocking(kernel);
+}
+
+//! op(X) as the packing routines see it: element (i, j) is data[i * rowStride + j * colStride].
+//! Covers both layouts and both transpose flags.
+template <typename In>
+struct GemmOperand
+{
+    const In *data;
+    size_t rowStride, colStride;
+
+    const In *at(int i, int j) const { return data + i * rowStride + j * colStride; }
+};
+
+//! Copy alpha * A[mc x kc] into MR-row slivers: sliver s holds rows s*MR.., column by column.
+//! Rows past mc are zero, so the microkernel never needs an edge case.
+//! Elements are converted from In to the kernel's T on the way.
+template <typename In, typename T>
+static void packA(int mc, int kc, int mr, const GemmOperand<In> &A, T alpha, T *Ap)
+{
+    for (int i = 0; i < mc; i += mr)
+    {
+        int rows = std::min(mr, mc - i);
+        for (int p = 0; p < kc; ++p)
+        {
+            const In *a = A.at(i, p);
+            for (int r = 0; r < rows; ++r)
+                Ap[r] = alpha * (T)a[r * A.rowStride];
+            for (int r = rows; r < mr; ++r)
+                Ap[r] = 0;
+            Ap += mr;
+        }
+    }
+}
+
+//! Copy B[kc x nc] into NR-column slivers: sliver s holds columns s*NR.., row by row.
+//! Columns past nc are zero.
+template <typename In, typename T>
+static void packB(int kc, int nc, int nr, const GemmOperand<In> &B, T *Bp)
+{
+    for (int j = 0; j < nc; j += nr)
+    {
+        int cols = std::min(nr, nc - j);
+        for (int p = 0; p < kc; ++p)
+        {
+            const In *b = B.at(p, j);
+            if (B.colStride == 1)
+            {
+                for (int c = 0; c < cols; ++c)
+                    Bp[c] = b[c];
+            }
+            else
+            {
+                for (int c = 0; c < cols; ++c)
+                    Bp[c] = b[c * B.colStride];
+            }
+            for (int c = cols; c < nr; ++c)
+                Bp[c] = 0;
+            Bp += nr;
+        }
+    }
+}
+
+//! C = beta * C over m x n (row-major); beta == 0 clears C without reading it
+template <typename T>
+static void scaleC(int m, int n, T beta, T *C, int ldc)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        T *c = C + (size_t)i * ldc;
+        if (beta == 0)
+            std::fill(c, c + n, T(0));
+        else
+            for (int j = 0; j < n; ++j)
+                c[j] *= beta;
+    }
+}
+
+//! Largest register tile of any kernel (avx512: 8x16 doubles, 8x32 floats), for the edge buffer
+const int GEMM_MAX_TILE = 8 * 32;
+
+//! One tile of C; a partial tile at the edge is computed in full into a
+//! buffer and only its top-left rows x cols are written back
+template <typename T>
+static void runTile(const GemmKernelT<T> &kernel, int kc, const T *Ap, const T *Bp, T *C, int ldc,
+                    bool accumulate, int rows, int cols)
+{
+    if (rows == kernel.mr && cols == kernel.nr)
+    {
+        kernel.run(kc, Ap, Bp, C, ldc, accumulate);
+        return;
+    }
+
+    alignas(64) T tile[GEMM_MAX_TILE];
+    kernel.run(kc, Ap, Bp, tile, kernel.nr, false);
+    for (int r = 0; r < rows; ++r)
+    {
+        T *c = C + (size_t)r * ldc;
+        const T *t = tile + r * kernel.nr;
+        for (int j = 0; j < cols; ++j)
+            c[j] = accumulate ? c[j] + t[j] : t[j];
+    }
+}
+
+//! C (row-major) = alpha * A * B + beta * C, serial blocked loop nest
+template <typename In, typename T>
+static void gemmSerial(int m, int n, int k, T alpha, const GemmOperand<In> &A, const GemmOperand<In> &B, T beta,
+                       T *C, int ldc, const GemmKernelT<T> &kernel, const GemmBlocking &blocking)
+{
+    // The first kc step overwrites C when beta == 0; otherwise C is scaled up front
+    // (unless beta == 1) and every step accumulates
+    if (k == 0 || alpha == 0 || (beta != 0 && beta != 1))
+        scaleC(m, n, beta, C, ldc);
+    if (k == 0 || alpha == 0)
+        return;
+    const bool accumulateFirst = beta != 0;
+
+    const int mr = kernel.mr, nr = kernel.nr;
+    static thread_local PackBuffer<T> bufA, bufB;
+    T *Ap = bufA.get((size_t)blocking.mc * blocking.kc + mr * blocking.kc);
+    T *Bp = bufB.get((size_t)blocking.kc * blocking.nc + nr * blocking.kc);
+
+    for (int jc = 0; jc < n; jc += blocking.nc)
+    {
+        int nc = std::min(blocking.nc, n - jc);
+        for (int pc = 0; pc < k; pc += blocking.kc)
+        {
+            int kc = std::min(blocking.kc, k - pc);
+            packB(kc, nc, nr, GemmOperand<In>{B.at(pc, jc), B.rowStride, B.colStride}, Bp);
+
+            for (int ic = 0; ic < m; ic += blocking.mc)
+            {
+                int mc = std::min(blocking.mc, m - ic);
+                packA(mc, kc, mr, GemmOperand<In>{A.at(ic, pc), A.rowStride, A.colStride}, alpha, Ap);
+
+                for (int jr = 0; jr < nc; jr += nr)
+                {
+                    for (int ir = 0; ir < mc; ir += mr)
+                    {
+                        runTile(kernel, kc, Ap + (size_t)ir * kc, Bp + (size_t)jr * kc,
+                                C + (size_t)(ic + ir) * ldc + jc + jr, ldc, pc > 0 || accumulateFirst,
+                                std::min(mr, mc - ir), std::min(nr, nc - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+//! Rows x columns of one parallel tile of C: roughly square, whole register tiles,
+//! no taller than mc, and about blocking.tiles tiles per participant
+template <typename T>
+static void parallelTileShape(int m, int nc, int participants, const GemmKernelT<T> &kernel, const GemmBlocking &blocking,
+                              int *tileRows, int *tileCols)
+{
+    double area = (double)m * nc / ((double)blocking.tiles * participants);
+    int rows = (int)std::sqrt(area);
+    rows = (rows + kernel.mr - 1) / kernel.mr * kernel.mr;
+    rows = std::max(kernel.mr, std::min(rows, std::max(kernel.mr, blocking.mc)));
+    int cols = (int)(area / rows);
+    cols = (cols + kernel.nr - 1) / kernel.nr * kernel.nr;
+    cols = std::max(kernel.nr, std::min(cols, nc));
+    *tileRows = rows;
+    *tileCols = cols;
+}
+
+//! C (row-major) = alpha * A * B + beta * C on the pool, 2D tiles of C
+template <typename In, typename T>
+static void gemmTiled(ThreadPool &pool, int m, int n, int k, T alpha, const GemmOperand<In> &A, const GemmOperand<In> &B,
+                      T beta, T *C, int ldc, const GemmKernelT<T> &kernel, const GemmBlocking &blocking)
+{
+    if (pool.size() == 1 || k == 0 || alpha == 0)
+    {
+        gemmSerial(m, n, k, alpha, A, B, beta, C, ldc, kernel, blocking);
+        return;
+    }
+
+    const int mr = kernel.mr, nr = kernel.nr;
+    const int mPadded = (m + mr - 1) / mr * mr;
+    static thread_local PackBuffer<T> bufA, bufB;
+    T *Ap = bufA.get((size_t)mPadded * blocking.kc);
+    T *Bp = bufB.get((size_t)blocking.kc * blocking.nc + nr * blocking.kc);
+    const bool accumulateFirst = beta != 0;
+
+    for (int jc = 0; jc < n; jc += blocking.nc)
+    {
+        int nc = std::min(blocking.nc, n - jc);
+        int tileRows, tileCols;
+        parallelTileShape(m, nc, pool.size(), kernel, blocking, &tileRows, &tileCols);
+        int rowTiles = (m + tileRows - 1) / tileRows;
+        int colTiles = (nc + tileCols - 1) / tileCols;
+
+        for (int pc = 0; pc < k; pc += blocking.kc)
+        {
+            int kc = std::min(blocking.kc, k - pc);
+
+            // Pack: one job per row tile of A and per column tile of B.
+            // On the first step the row tile jobs also apply beta to their rows of C.
+            pool.parallelFor(rowTiles + colTiles, [&](int job, int)
+                             {
+                                 if (job < rowTiles)
+                                 {
+                                     int row = job * tileRows, rows = std::min(tileRows, m - row);
+                                     packA(rows, kc, mr, GemmOperand<In>{A.at(row, pc), A.rowStride, A.colStride}, alpha,
+                                           Ap + (size_t)row * kc);
+                                     if (pc == 0 && beta != 0 && beta != 1)
+                                         scaleC(rows, nc, beta, C + (size_t)row * ldc + jc, ldc);
+                                 }
+                                 else
+                                 {
+                                     int col = (job - rowTiles) * tileCols;
+                                     packB(kc, std::min(tileCols, nc - col), nr,
+                                           GemmOperand<In>{B.at(pc, jc + col), B.rowStride, B.colStride}, Bp + (size_t)col * kc);
+                                 }
+                             });
+
+            // Compute: row-major tile order, so participants starting at the same
+            // time share the A slivers of one row tile
+            pool.parallelFor(rowTiles * colTiles, [&](int tile, int)
+                             {
+                                 int row = tile / colTiles * tileRows, col = tile % colTiles * tileCols;
+                                 int rows = std::min(tileRows, m - row), cols = std::min(tileCols, nc - col);
+                                 for (int jr = 0; jr < cols; jr += nr)
+                                 {
+                                     for (int ir = 0; ir < rows; ir += mr)
+                                     {
+                                         runTile(kernel, kc, Ap + (size_t)(row + ir) * kc, Bp + (size_t)(col + jr) * kc,
+                                                 C + (size_t)(row + ir) * ldc + jc + col + jr, ldc,
+                                                 pc > 0 || accumulateFirst, std::min(mr, rows - ir), std::min(nr, cols - jr));
+                                     }
+                                 }
+                             });
+        }
+    }
+}
+
+//! Bring any call to row-major form. Column-major storage of X is row-major storage
+//! of X^T, and C^T = op(B)^T * op(A)^T, so a column-major call is the row-major call
+//! with A and B (and m and n) swapped.
+template <typename In>
+static void rowMajorOperands(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int *m, int *n,
+                             const In *A, int lda, const In *B, int ldb, GemmOperand<In> *opA, GemmOperand<In> *opB)
+{
+    if (layout == GemmColMajor)
+    {
+        std::swap(*m, *n);
+        std::swap(A, B);
+        std::swap(lda, ldb);
+        std::swap(transA, transB);
+    }
+    *opA = transA == GemmNoTrans ? GemmOperand<In>{A, (size_t)lda, 1} : GemmOperand<In>{A, 1, (size_t)lda};
+    *opB = transB == GemmNoTrans ? GemmOperand<In>{B, (size_t)ldb, 1} : GemmOperand<In>{B, 1, (size_t)ldb};
+}
+
+template <typename In, typename T>
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, T alpha,
+          const In *A, int lda, const In *B, int ldb, T beta, T *C, int ldc, ThreadPool *pool,
+          const GemmKernelT<T> &kernel, const GemmBlocking &blocking)
+{
+    if (m <= 0 || n <= 0)
+        return;
+
+    GemmOperand<In> opA, opB;
+    rowMajorOperands(layout, transA, transB, &m, &n, A, lda, B, ldb, &opA, &opB);
+    if (pool)
+        gemmTiled(*pool, m, n, k, alpha, opA, opB, beta, C, ldc, kernel, blocking);
+    else
+        gemmSerial(m, n, k, alpha, opA, opB, beta, C, ldc, kernel, blocking);
+}
+
+//! gemm() for a single element type: the unrolled kernels where they apply, else the blocked path
+template <typename T>
+static void gemmDispatch(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, T alpha,
+                         const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc, ThreadPool *pool)
+{
+    if (transA == GemmNoTrans && transB == GemmNoTrans && m == n && n == k)
+    {
+        // The layout doesn't matter to these: swap the operands for column-major
+        const T *X = layout == GemmRowMajor ? A : B, *Y = layout == GemmRowMajor ? B : A;
+        int ldx = layout == GemmRowMajor ? lda : ldb, ldy = layout == GemmRowMajor ? ldb : lda;
+        if (gemmSmallSquare(m, alpha, X, ldx, Y, ldy, beta, C, ldc))
+            return;
+    }
+
+    const GemmKernelT<T> &kernel = activeGemmKernel<T>();
+    gemm(layout, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, pool, kernel, defaultBlocking(kernel));
+}
+
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+          const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc, ThreadPool *pool)
+{
+    gemmDispatch(layout, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, pool);
+}
+
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, float alpha,
+          const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc, ThreadPool *pool)
+{
+    gemmDispatch(layout, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, pool);
+}
+
+void gemm(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+          const float *A, int lda, const float *B, int ldb, double beta, double *C, int ldc, ThreadPool *pool)
+{
+    const GemmKernel &kernel = activeGemmKernel();
+    gemm(layout, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, pool, kernel, defaultBlocking(kernel));
+}
+
+void gemmBlocked(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                 const GemmKernel &kernel, const GemmBlocking &blocking)
+{
+    gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, 1.0, A, lda, B, ldb, 0.0, C, ldc, NULL, kernel, blocking);
+}
+
+void gemmBlocked(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc)
+{
+    const GemmKernel &kernel = activeGemmKernel();
+    gemmBlocked(m, n, k, A, lda, B, ldb, C, ldc, kernel, defaultBlocking(kernel));
+}
+
+void gemmParallel(ThreadPool &pool, int m, int n, int k, const double *A, int lda, const double *B, int ldb,
+                  double *C, int ldc, const GemmKernel &kernel, const GemmBlocking &blocking)
+{
+    gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, 1.0, A, lda, B, ldb, 0.0, C, ldc, &pool, kernel, blocking);
+}
+
+void gemmParallel(ThreadPool &pool, int m, int n, int k, const double *A, int lda, const double *B, int ldb,
+                  double *C, int ldc)
+{
+    const GemmKernel &kernel = activeGemmKernel();
+    gemmParallel(pool, m, n, k, A, lda, B, ldb, C, ldc, kernel, defaultBlocking(kernel));
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef GemmBatch_h
+#define GemmBatch_h
+
+#include <algorithm>
+#include <cstddef>
+#include "Gemm.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Kernel every entry of a batch runs with, picked once per call from the shape
+enum GemmBatchPath
+{
+    GemmBatchUnrolled, // gemmSmallSquare(): square 4, 8, 16, untransposed
+    GemmBatchSmall,    // gemmSmallRows(): every dimension up to GEMM_SMALL_MAX, B untransposed
+    GemmBatchBlocked   // gemm() on the packed, blocked path, one thread per entry
+};
+
+GemmBatchPath gemmBatchPath(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k);
+
+const char *gemmBatchPathName(GemmBatchPath path);
+
+//! C_i = alpha * op(A_i) * op(B_i) + beta * C_i for i in [0, batch), all entries the same shape.
+//! Entry i starts at A + i * strideA, B + i * strideB and C + i * strideC (in elements).
+//! - With a pool the entries are spread over the threads, each entry on one thread;
+//!   tiny entries are handed out in chunks so the pool's counter isn't the bottleneck
+//! - Arguments otherwise as for gemm()
+void gemmBatchedStrided(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k,
+                        double alpha, const double *A, int lda, ptrdiff_t strideA, const double *B, int ldb,
+                        ptrdiff_t strideB, double beta, double *C, int ldc, ptrdiff_t strideC, int batch,
+                        ThreadPool *pool = NULL);
+
+//! Same, with entry i at A[i], B[i] and C[i]
+void gemmBatched(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+                 const double *const *A, int lda, const double *const *B, int ldb, double beta, double *const *C,
+                 int ldc, int batch, ThreadPool *pool = NULL);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+GemmBatchPath gemmBatchPath(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k)
+{
+    // Decide on the row-major form, where column-major swaps the operands
+    if (layout == GemmColMajor)
+    {
+        std::swap(transA, transB);
+        std::swap(m, n);
+    }
+
+    if (transA == GemmNoTrans && transB == GemmNoTrans && m == n && n == k && (m == 4 || m == 8 || m == 16))
+        return GemmBatchUnrolled;
+    if (transB == GemmNoTrans && std::max(m, std::max(n, k)) <= GEMM_SMALL_MAX)
+        return GemmBatchSmall;
+    return GemmBatchBlocked;
+}
+
+const char *gemmBatchPathName(GemmBatchPath path)
+{
+    switch (path)
+    {
+    case GemmBatchUnrolled:
+        return "unrolled";
+    case GemmBatchSmall:
+        return "small";
+    default:
+        return "blocked";
+    }
+}
+
+//! Shared driver; entry(i, &a, &b, &c) yields the operands of entry i
+template <typename Entry>
+static void gemmBatchRun(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k,
+                         double alpha, int lda, int ldb, double beta, int ldc, int batch, ThreadPool *pool,
+                         const Entry &entry)
+{
+    if (batch <= 0 || m <= 0 || n <= 0)
+        return;
+
+    const GemmBatchPath path = gemmBatchPath(layout, transA, transB, m, n, k);
+    const GemmKernel &kernel = activeGemmKernel();
+    const GemmBlocking blocking = defaultBlocking(kernel);
+
+    // Row-major form of the call, as in gemm()
+    const bool swap = layout == GemmColMajor;
+    const int rm = swap ? n : m, rn = swap ? m : n;
+    const GemmTranspose ta = swap ? transB : transA, tb = swap ? transA : transB;
+    const int la = swap ? ldb : lda, lb = swap ? lda : ldb;
+
+    auto one = [&](int i)
+    {
+        const double *a, *b;
+        double *c;
+        entry(i, &a, &b, &c);
+        if (swap)
+            std::swap(a, b);
+
+        switch (path)
+        {
+        case GemmBatchUnrolled:
+            gemmSmallSquare(rm, alpha, a, la, b, lb, beta, c, ldc);
+            break;
+        case GemmBatchSmall:
+            gemmSmallRows(rm, rn, k, alpha, a, ta == GemmNoTrans ? la : 1, ta == GemmNoTrans ? 1 : la, b, lb, beta, c, ldc);
+            break;
+        default:
+            gemm(GemmRowMajor, ta, tb, rm, rn, k, alpha, a, la, b, lb, beta, c, ldc, NULL, kernel, blocking);
+            break;
+        }
+    };
+
+    if (!pool || pool->size() == 1)
+    {
+        for (int i = 0; i < batch; ++i)
+            one(i);
+        return;
+    }
+
+    // About 64K flops per chunk, but still several chunks per participant
+    double flops = std::max(1.0, 2.0 * m * n * k);
+    int chunk = (int)std::max(1.0, 65536.0 / flops);
+    chunk = std::max(1, std::min(chunk, batch / (4 * pool->size())));
+    pool->parallelFor(batch, [&](int i, int)
+                      { one(i); },
+                      chunk);
+}
+
+void gemmBatchedStrided(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k,
+                        double alpha, const double *A, int lda, ptrdiff_t strideA, const double *B, int ldb,
+                        ptrdiff_t strideB, double beta, double *C, int ldc, ptrdiff_t strideC, int batch,
+                        ThreadPool *pool)
+{
+    gemmBatchRun(layout, transA, transB, m, n, k, alpha, lda, ldb, beta, ldc, batch, pool,
+                 [=](int i, const double **a, const double **b, double **c)
+                 {
+                     *a = A + i * strideA;
+                     *b = B + i * strideB;
+                     *c = C + i * strideC;
+                 });
+}
+
+void gemmBatched(GemmLayout layout, GemmTranspose transA, GemmTranspose transB, int m, int n, int k, double alpha,
+                 const double *const *A, int lda, const double *const *B, int ldb, double beta, double *const *C,
+                 int ldc, int batch, ThreadPool *pool)
+{
+    gemmBatchRun(layout, transA, transB, m, n, k, alpha, lda, ldb, beta, ldc, batch, pool,
+                 [=](int i, const double **a, const double **b, double **c)
+                 {
+                     *a = A[i];
+                     *b = B[i];
+                     *c = C[i];
+                 });
+}
+
+#endif
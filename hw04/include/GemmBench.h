@@ -0,0 +1,301 @@
+#ifndef GemmBench_h
+#define GemmBench_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Gemm.h"
+#include "GemmTune.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Per-call timing of one benchmark, in seconds
+struct BenchStats
+{
+    int runs;
+    double min, median, p95, mean;
+};
+
+//! Time f: `warmup` untimed calls, then timed calls until there are at least minRuns
+//! and together they took minSeconds (at most maxRuns)
+BenchStats benchmark(const std::function<void()> &f, int warmup = 2, int minRuns = 5, double minSeconds = 0.2,
+                     int maxRuns = 1000);
+
+//! Kernel throughput with every participant of the pool running it on its own L1-resident panels
+template <typename T>
+double measurePeakGflops(const GemmKernelT<T> &kernel, ThreadPool &pool);
+
+//! STREAM-style triad (a = b + s * c) over three arrays of `bytes` each, in GB/s
+double measureBandwidth(ThreadPool &pool, size_t bytes = 256u << 20);
+
+//! One product shape of the sweep
+struct BenchShape
+{
+    int m, n, k;
+};
+
+//! One measured configuration
+struct BenchResult
+{
+    BenchShape shape;
+    std::string type;   // "double", "float" or "mixed" (float in, double out)
+    std::string kernel; // Microkernel name
+    int threads;
+    BenchStats stats;
+    double gflops;      // 2mnk / median
+    double gflopsP95;   // 2mnk / p95
+    double peak;        // measurePeakGflops() of the kernel on this pool
+    double bandwidth;   // measureBandwidth() of this pool, GB/s
+    double intensity;   // Flops per byte of A, B and C each moved once
+    double roofline;    // min(peak, intensity * bandwidth)
+};
+
+//! Sweep shapes x thread counts x every supported kernel for double, float and
+//! mixed precision through gemm() with the given kernel and its default blocking.
+//! Pools are created per thread count; peak and bandwidth are measured on each.
+std::vector<BenchResult> runGemmBench(const std::vector<BenchShape> &shapes, const std::vector<int> &threadCounts,
+                                      bool pin);
+
+//! One row per result, with a header line
+void writeBenchCsv(std::ostream &out, const std::vector<BenchResult> &results);
+
+//! {"machine": ..., "date": ..., "results": [...]}
+void writeBenchJson(std::ostream &out, const std::vector<BenchResult> &results);
+
+//! The same results as an ASCII table in the style of hw04Result.txt
+void writeBenchTable(std::ostream &out, const std::vector<BenchResult> &results);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+BenchStats benchmark(const std::function<void()> &f, int warmup, int minRuns, double minSeconds, int maxRuns)
+{
+    for (int i = 0; i < warmup; ++i)
+        f();
+
+    std::vector<double> samples;
+    double total = 0;
+    while ((int)samples.size() < std::max(1, minRuns) || (total < minSeconds && (int)samples.size() < maxRuns))
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+        total += elapsed.count();
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    BenchStats stats;
+    stats.runs = (int)count;
+    stats.min = samples.front();
+    stats.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stats.p95 = samples[std::min(count - 1, (size_t)std::ceil(0.95 * count) - 1)];
+    stats.mean = total / count;
+    return stats;
+}
+
+template <typename T>
+double measurePeakGflops(const GemmKernelT<T> &kernel, ThreadPool &pool)
+{
+    // Panels small enough for L1, many calls per chunk so the pool's overhead vanishes
+    const int kc = 128, callsPerChunk = 500, chunksPerParticipant = 8;
+    const int chunks = chunksPerParticipant * pool.size();
+
+    double best = 0;
+    for (int round = 0; round < 3; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pool.parallelFor(chunks, [&](int, int)
+                         {
+                             static thread_local PackBuffer<T> bufA, bufB, bufC;
+                             T *Ap = bufA.get((size_t)kernel.mr * kc), *Bp = bufB.get((size_t)kernel.nr * kc);
+                             T *C = bufC.get((size_t)kernel.mr * kernel.nr);
+                             std::fill(Ap, Ap + (size_t)kernel.mr * kc, T(0.5));
+                             std::fill(Bp, Bp + (size_t)kernel.nr * kc, T(0.5));
+                             for (int call = 0; call < callsPerChunk; ++call)
+                                 kernel.run(kc, Ap, Bp, C, kernel.nr, false);
+                         });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double flops = 2.0 * kernel.mr * kernel.nr * kc * callsPerChunk * chunks;
+        best = std::max(best, flops / elapsed.count() / 1e9);
+    }
+    return best;
+}
+
+double measureBandwidth(ThreadPool &pool, size_t bytes)
+{
+    const size_t count = bytes / sizeof(double);
+    PackBuffer<double> bufA, bufB, bufC;
+    double *a = bufA.get(count), *b = bufB.get(count), *c = bufC.get(count);
+
+    // First touch from the participants that will stream the slice
+    const int slices = 4 * pool.size();
+    auto slice = [&](int s, size_t *first, size_t *last)
+    {
+        *first = count * s / slices;
+        *last = count * (s + 1) / slices;
+    };
+    pool.parallelFor(slices, [&](int s, int)
+                     {
+                         size_t first, last;
+                         slice(s, &first, &last);
+                         std::fill(a + first, a + last, 0.0);
+                         std::fill(b + first, b + last, 1.0);
+                         std::fill(c + first, c + last, 2.0);
+                     });
+
+    double best = 0;
+    for (int round = 0; round < 4; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pool.parallelFor(slices, [&](int s, int)
+                         {
+                             size_t first, last;
+                             slice(s, &first, &last);
+                             for (size_t i = first; i < last; ++i)
+                                 a[i] = b[i] + 3.0 * c[i];
+                         });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, 3.0 * bytes / elapsed.count() / 1e9);
+    }
+    return best;
+}
+
+//! Time every supported kernel of T on every shape, with A and B of type In
+template <typename In, typename T>
+static void benchVariant(const char *type, const std::vector<BenchShape> &shapes, ThreadPool &pool,
+                         double bandwidth, std::vector<BenchResult> *results)
+{
+    int count;
+    const GemmKernelT<T> *kernels = gemmKernels<T>(&count);
+    for (int i = 0; i < count; ++i)
+    {
+        const GemmKernelT<T> &kernel = kernels[i];
+        if (!gemmKernelSupported(kernel))
+            continue;
+        const GemmBlocking blocking = defaultBlocking(kernel);
+        const double peak = measurePeakGflops(kernel, pool);
+
+        for (const BenchShape &s : shapes)
+        {
+            std::vector<In> A((size_t)s.m * s.k, In(0.5)), B((size_t)s.k * s.n, In(0.25));
+            std::vector<T> C((size_t)s.m * s.n);
+
+            BenchResult r;
+            r.shape = s;
+            r.type = type;
+            r.kernel = kernel.name;
+            r.threads = pool.size();
+            r.stats = benchmark([&]()
+                                { gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, s.m, s.n, s.k, T(1), A.data(), s.k, B.data(),
+                                       s.n, T(0), C.data(), s.n, &pool, kernel, blocking); });
+
+            double flops = 2.0 * s.m * s.n * s.k;
+            double bytes = ((double)s.m * s.k + (double)s.k * s.n) * sizeof(In) + (double)s.m * s.n * sizeof(T);
+            r.gflops = flops / r.stats.median / 1e9;
+            r.gflopsP95 = flops / r.stats.p95 / 1e9;
+            r.peak = peak;
+            r.bandwidth = bandwidth;
+            r.intensity = flops / bytes;
+            r.roofline = std::min(peak, r.intensity * bandwidth);
+            results->push_back(r);
+        }
+    }
+}
+
+std::vector<BenchResult> runGemmBench(const std::vector<BenchShape> &shapes, const std::vector<int> &threadCounts,
+                                      bool pin)
+{
+    std::vector<BenchResult> results;
+    for (int threads : threadCounts)
+    {
+        ThreadPool pool(std::max(1, threads), pin);
+        double bandwidth = measureBandwidth(pool);
+        benchVariant<double, double>("double", shapes, pool, bandwidth, &results);
+        benchVariant<float, float>("float", shapes, pool, bandwidth, &results);
+        benchVariant<float, double>("mixed", shapes, pool, bandwidth, &results);
+    }
+    return results;
+}
+
+void writeBenchCsv(std::ostream &out, const std::vector<BenchResult> &results)
+{
+    out << "m,n,k,type,kernel,threads,runs,min_s,median_s,p95_s,mean_s,gflops,gflops_p95,peak_gflops,bandwidth_gbs,"
+           "intensity,roofline_gflops,roofline_fraction"
+        << std::endl;
+    for (const BenchResult &r : results)
+    {
+        out << r.shape.m << "," << r.shape.n << "," << r.shape.k << "," << r.type << "," << r.kernel << "," << r.threads
+            << "," << r.stats.runs << "," << r.stats.min << "," << r.stats.median << "," << r.stats.p95 << ","
+            << r.stats.mean << "," << r.gflops << "," << r.gflopsP95 << "," << r.peak << "," << r.bandwidth << ","
+            << r.intensity << "," << r.roofline << "," << r.gflops / r.roofline << std::endl;
+    }
+}
+
+//! The string with quotes and backslashes escaped, in quotes
+static std::string jsonString(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void writeBenchJson(std::ostream &out, const std::vector<BenchResult> &results)
+{
+    char date[32];
+    std::time_t now = std::time(NULL);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out << "{" << std::endl;
+    out << "  \"machine\": " << jsonString(gemmMachineId()) << "," << std::endl;
+    out << "  \"date\": " << jsonString(date) << "," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &r = results[i];
+        out << "    {\"m\": " << r.shape.m << ", \"n\": " << r.shape.n << ", \"k\": " << r.shape.k
+            << ", \"type\": " << jsonString(r.type) << ", \"kernel\": " << jsonString(r.kernel)
+            << ", \"threads\": " << r.threads << ", \"runs\": " << r.stats.runs << ", \"min_s\": " << r.stats.min
+            << ", \"median_s\": " << r.stats.median << ", \"p95_s\": " << r.stats.p95 << ", \"mean_s\": " << r.stats.mean
+            << ", \"gflops\": " << r.gflops << ", \"gflops_p95\": " << r.gflopsP95 << ", \"peak_gflops\": " << r.peak
+            << ", \"bandwidth_gbs\": " << r.bandwidth << ", \"intensity\": " << r.intensity
+            << ", \"roofline_gflops\": " << r.roofline << ", \"roofline_fraction\": " << r.gflops / r.roofline << "}"
+            << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+void writeBenchTable(std::ostream &out, const std::vector<BenchResult> &results)
+{
+    const char *rule = "|----------------|--------|--------|---------|--------------|------------|------------|----------|";
+    out << std::left << std::setw(18) << "Benchmark: " << gemmMachineId() << std::endl;
+    out << rule << std::endl;
+    out << "|     Shape      |  Type  | Kernel | Threads | Median (sec) |   GFLOPS   | GFLOPS p95 | Roofline |" << std::endl;
+    out << rule << std::endl;
+    for (const BenchResult &r : results)
+    {
+        std::string shape = std::to_string(r.shape.m) + "x" + std::to_string(r.shape.n) + "x" + std::to_string(r.shape.k);
+        std::string fraction = std::to_string((int)std::lround(100 * r.gflops / r.roofline)) + "%";
+        out << "|" << std::setw(15) << shape << " | " << std::setw(6) << r.type << " | " << std::setw(6) << r.kernel << " | "
+            << std::setw(7) << r.threads << " | " << std::setw(12) << r.stats.median << " | " << std::setw(10) << r.gflops
+            << " | " << std::setw(10) << r.gflopsP95 << " | " << std::setw(8) << fraction << " |" << std::endl;
+    }
+    out << rule << std::endl;
+}
+
+#endif
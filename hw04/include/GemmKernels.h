@@ -0,0 +1,405 @@
+#ifndef GemmKernels_h
+#define GemmKernels_h
+
+#include <cstddef>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Full MR x NR tile: C (+)= Ap * Bp over kc, in element type T (float or double)
+//! - Ap: kc steps of MR values (one packed sliver of A)
+//! - Bp: kc steps of NR values (one packed sliver of B)
+//! - accumulate == false overwrites C instead of adding to it
+template <typename T>
+using GemmMicroKernelT = void (*)(int kc, const T *Ap, const T *Bp, T *C, int ldc, bool accumulate);
+
+//! One microkernel and the register tile it computes
+template <typename T>
+struct GemmKernelT
+{
+    const char *name;
+    int mr, nr;
+    GemmMicroKernelT<T> run;
+};
+
+typedef GemmKernelT<double> GemmKernel;
+typedef GemmKernelT<float> GemmKernelF;
+
+//! Every kernel for element type T compiled into this build, scalar first.
+//! Both types have a kernel of each name, float ones with twice the columns.
+template <typename T = double>
+const GemmKernelT<T> *gemmKernels(int *count);
+
+//! Whether this CPU can run the kernel
+template <typename T>
+bool gemmKernelSupported(const GemmKernelT<T> &kernel);
+
+//! The kernel gemmBlocked() uses by default: the widest one the CPU supports
+//! (checked with cpuid once), unless forceGemmKernel() picked another
+template <typename T = double>
+const GemmKernelT<T> &activeGemmKernel();
+
+//! Use the named kernel ("scalar", "sse2", "avx2", "avx512") from now on, for
+//! both element types. Returns false, leaving the choice unchanged, if it is
+//! unknown or unsupported.
+bool forceGemmKernel(const char *name);
+
+//! Same, for element type T only
+template <typename T>
+bool forceGemmKernel(const char *name);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+//! Portable kernel; the compiler keeps acc in registers and may vectorize it
+template <typename T, int MR, int NR>
+static void microkernelScalar(int kc, const T *Ap, const T *Bp, T *C, int ldc, bool accumulate)
+{
+    T acc[MR][NR] = {};
+
+    for (int p = 0; p < kc; ++p)
+    {
+        for (int r = 0; r < MR; ++r)
+        {
+            T a = Ap[r];
+            for (int c = 0; c < NR; ++c)
+                acc[r][c] += a * Bp[c];
+        }
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int r = 0; r < MR; ++r)
+    {
+        T *c = C + (size_t)r * ldc;
+        for (int j = 0; j < NR; ++j)
+            c[j] = accumulate ? c[j] + acc[r][j] : acc[r][j];
+    }
+}
+
+#ifdef GEMM_X86_DISPATCH
+
+//! 4x4 tile in 8 xmm accumulators (2 doubles each)
+__attribute__((target("sse2")))
+static void microkernelSSE2(int kc, const double *Ap, const double *Bp, double *C, int ldc, bool accumulate)
+{
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m128d b0 = _mm_load_pd(Bp), b1 = _mm_load_pd(Bp + 2);
+        __m128d a;
+        a = _mm_load1_pd(Ap + 0);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(a, b0));
+        c01 = _mm_add_pd(c01, _mm_mul_pd(a, b1));
+        a = _mm_load1_pd(Ap + 1);
+        c10 = _mm_add_pd(c10, _mm_mul_pd(a, b0));
+        c11 = _mm_add_pd(c11, _mm_mul_pd(a, b1));
+        a = _mm_load1_pd(Ap + 2);
+        c20 = _mm_add_pd(c20, _mm_mul_pd(a, b0));
+        c21 = _mm_add_pd(c21, _mm_mul_pd(a, b1));
+        a = _mm_load1_pd(Ap + 3);
+        c30 = _mm_add_pd(c30, _mm_mul_pd(a, b0));
+        c31 = _mm_add_pd(c31, _mm_mul_pd(a, b1));
+        Ap += 4;
+        Bp += 4;
+    }
+
+    __m128d acc[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (int r = 0; r < 4; ++r)
+    {
+        double *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m128d v = acc[r][j];
+            if (accumulate)
+                v = _mm_add_pd(v, _mm_loadu_pd(c + 2 * j));
+            _mm_storeu_pd(c + 2 * j, v);
+        }
+    }
+}
+
+//! 6x8 tile in 12 ymm accumulators, leaving 4 registers for B and the broadcasts
+__attribute__((target("avx2,fma")))
+static void microkernelAVX2(int kc, const double *Ap, const double *Bp, double *C, int ldc, bool accumulate)
+{
+    __m256d acc[6][2];
+    for (int r = 0; r < 6; ++r)
+        acc[r][0] = acc[r][1] = _mm256_setzero_pd();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m256d b0 = _mm256_load_pd(Bp), b1 = _mm256_load_pd(Bp + 4);
+        for (int r = 0; r < 6; ++r)
+        {
+            __m256d a = _mm256_broadcast_sd(Ap + r);
+            acc[r][0] = _mm256_fmadd_pd(a, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_pd(a, b1, acc[r][1]);
+        }
+        Ap += 6;
+        Bp += 8;
+    }
+
+    for (int r = 0; r < 6; ++r)
+    {
+        double *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m256d v = acc[r][j];
+            if (accumulate)
+                v = _mm256_add_pd(v, _mm256_loadu_pd(c + 4 * j));
+            _mm256_storeu_pd(c + 4 * j, v);
+        }
+    }
+}
+
+//! 8x16 tile in 16 zmm accumulators
+__attribute__((target("avx512f")))
+static void microkernelAVX512(int kc, const double *Ap, const double *Bp, double *C, int ldc, bool accumulate)
+{
+    __m512d acc[8][2];
+    for (int r = 0; r < 8; ++r)
+        acc[r][0] = acc[r][1] = _mm512_setzero_pd();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m512d b0 = _mm512_load_pd(Bp), b1 = _mm512_load_pd(Bp + 8);
+        for (int r = 0; r < 8; ++r)
+        {
+            __m512d a = _mm512_set1_pd(Ap[r]);
+            acc[r][0] = _mm512_fmadd_pd(a, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_pd(a, b1, acc[r][1]);
+        }
+        Ap += 8;
+        Bp += 16;
+    }
+
+    for (int r = 0; r < 8; ++r)
+    {
+        double *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m512d v = acc[r][j];
+            if (accumulate)
+                v = _mm512_add_pd(v, _mm512_loadu_pd(c + 8 * j));
+            _mm512_storeu_pd(c + 8 * j, v);
+        }
+    }
+}
+
+//! 4x8 tile in 8 xmm accumulators (4 floats each)
+__attribute__((target("sse2")))
+static void microkernelSSE2F(int kc, const float *Ap, const float *Bp, float *C, int ldc, bool accumulate)
+{
+    __m128 acc[4][2];
+    for (int r = 0; r < 4; ++r)
+        acc[r][0] = acc[r][1] = _mm_setzero_ps();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m128 b0 = _mm_load_ps(Bp), b1 = _mm_load_ps(Bp + 4);
+        for (int r = 0; r < 4; ++r)
+        {
+            __m128 a = _mm_set1_ps(Ap[r]);
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(a, b0));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(a, b1));
+        }
+        Ap += 4;
+        Bp += 8;
+    }
+
+    for (int r = 0; r < 4; ++r)
+    {
+        float *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m128 v = acc[r][j];
+            if (accumulate)
+                v = _mm_add_ps(v, _mm_loadu_ps(c + 4 * j));
+            _mm_storeu_ps(c + 4 * j, v);
+        }
+    }
+}
+
+//! 6x16 tile in 12 ymm accumulators (8 floats each)
+__attribute__((target("avx2,fma")))
+static void microkernelAVX2F(int kc, const float *Ap, const float *Bp, float *C, int ldc, bool accumulate)
+{
+    __m256 acc[6][2];
+    for (int r = 0; r < 6; ++r)
+        acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m256 b0 = _mm256_load_ps(Bp), b1 = _mm256_load_ps(Bp + 8);
+        for (int r = 0; r < 6; ++r)
+        {
+            __m256 a = _mm256_broadcast_ss(Ap + r);
+            acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+        }
+        Ap += 6;
+        Bp += 16;
+    }
+
+    for (int r = 0; r < 6; ++r)
+    {
+        float *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m256 v = acc[r][j];
+            if (accumulate)
+                v = _mm256_add_ps(v, _mm256_loadu_ps(c + 8 * j));
+            _mm256_storeu_ps(c + 8 * j, v);
+        }
+    }
+}
+
+//! 8x32 tile in 16 zmm accumulators (16 floats each)
+__attribute__((target("avx512f")))
+static void microkernelAVX512F(int kc, const float *Ap, const float *Bp, float *C, int ldc, bool accumulate)
+{
+    __m512 acc[8][2];
+    for (int r = 0; r < 8; ++r)
+        acc[r][0] = acc[r][1] = _mm512_setzero_ps();
+
+    for (int p = 0; p < kc; ++p)
+    {
+        __m512 b0 = _mm512_load_ps(Bp), b1 = _mm512_load_ps(Bp + 16);
+        for (int r = 0; r < 8; ++r)
+        {
+            __m512 a = _mm512_set1_ps(Ap[r]);
+            acc[r][0] = _mm512_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(a, b1, acc[r][1]);
+        }
+        Ap += 8;
+        Bp += 32;
+    }
+
+    for (int r = 0; r < 8; ++r)
+    {
+        float *c = C + (size_t)r * ldc;
+        for (int j = 0; j < 2; ++j)
+        {
+            __m512 v = acc[r][j];
+            if (accumulate)
+                v = _mm512_add_ps(v, _mm512_loadu_ps(c + 16 * j));
+            _mm512_storeu_ps(c + 16 * j, v);
+        }
+    }
+}
+
+#endif
+
+static const GemmKernel gemmKernelTable[] = {
+    {"scalar", 4, 8, microkernelScalar<double, 4, 8>},
+#ifdef GEMM_X86_DISPATCH
+    {"sse2", 4, 4, microkernelSSE2},
+    {"avx2", 6, 8, microkernelAVX2},
+    {"avx512", 8, 16, microkernelAVX512},
+#endif
+};
+
+static const GemmKernelF gemmKernelTableF[] = {
+    {"scalar", 4, 16, microkernelScalar<float, 4, 16>},
+#ifdef GEMM_X86_DISPATCH
+    {"sse2", 4, 8, microkernelSSE2F},
+    {"avx2", 6, 16, microkernelAVX2F},
+    {"avx512", 8, 32, microkernelAVX512F},
+#endif
+};
+
+template <>
+const GemmKernel *gemmKernels<double>(int *count)
+{
+    *count = sizeof(gemmKernelTable) / sizeof(gemmKernelTable[0]);
+    return gemmKernelTable;
+}
+
+template <>
+const GemmKernelF *gemmKernels<float>(int *count)
+{
+    *count = sizeof(gemmKernelTableF) / sizeof(gemmKernelTableF[0]);
+    return gemmKernelTableF;
+}
+
+//! Kernels of the same name need the same instruction set for either type
+static bool gemmIsaSupported(const char *name)
+{
+#ifdef GEMM_X86_DISPATCH
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (strcmp(name, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+template <typename T>
+bool gemmKernelSupported(const GemmKernelT<T> &kernel)
+{
+    return gemmIsaSupported(kernel.name);
+}
+
+template <typename T>
+static const GemmKernelT<T> *&gemmKernelChoice()
+{
+    static const GemmKernelT<T> *choice = NULL;
+    return choice;
+}
+
+template <typename T>
+const GemmKernelT<T> &activeGemmKernel()
+{
+    const GemmKernelT<T> *&choice = gemmKernelChoice<T>();
+    if (!choice)
+    {
+        // The table is ordered from narrowest to widest
+        int count;
+        const GemmKernelT<T> *kernels = gemmKernels<T>(&count);
+        choice = &kernels[0];
+        for (int i = 0; i < count; ++i)
+        {
+            if (gemmKernelSupported(kernels[i]))
+                choice = &kernels[i];
+        }
+    }
+    return *choice;
+}
+
+template <typename T>
+bool forceGemmKernel(const char *name)
+{
+    int count;
+    const GemmKernelT<T> *kernels = gemmKernels<T>(&count);
+    for (int i = 0; i < count; ++i)
+    {
+        if (strcmp(kernels[i].name, name) == 0 && gemmKernelSupported(kernels[i]))
+        {
+            gemmKernelChoice<T>() = &kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool forceGemmKernel(const char *name)
+{
+    // The tables hold the same names, so either both succeed or neither does
+    return forceGemmKernel<double>(name) && forceGemmKernel<float>(name);
+}
+
+#endif
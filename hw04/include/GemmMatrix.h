@@ -0,0 +1,202 @@
+#ifndef GemmMatrix_h
+#define GemmMatrix_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include "Gemm.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Bytes of one transparent huge page; smaller allocations never ask for them
+#define GEMM_HUGE_PAGE (2 * 1024 * 1024)
+
+//! Row-major matrix storage for gemm()
+//! - Every row starts on a 64-byte cache line
+//! - The leading dimension is padded so that consecutive rows don't map to the
+//!   same cache sets (see gemmPaddedLd())
+//! - With hugePages, storage of at least GEMM_HUGE_PAGE bytes is mapped on
+//!   2 MiB boundaries and madvise()d for transparent huge pages, so a 1000 x 1200
+//!   operand needs a few TLB entries instead of hundreds. The kernel may still
+//!   decline; usesHugePages() says whether the advice was accepted.
+//! - Padding elements are zero and stay out of every gemm() call
+template <typename T>
+class GemmMatrix
+{
+    T *storage;
+    int nRows, nCols, stride;
+    size_t bytes;
+    bool mapped, huge;
+
+    void release();
+
+public:
+    GemmMatrix() : storage(NULL), nRows(0), nCols(0), stride(0), bytes(0), mapped(false), huge(false) {}
+    GemmMatrix(int rows, int cols, bool hugePages = false, bool pad = true);
+    GemmMatrix(GemmMatrix &&other);
+    GemmMatrix &operator=(GemmMatrix &&other);
+    GemmMatrix(const GemmMatrix &) = delete;
+    GemmMatrix &operator=(const GemmMatrix &) = delete;
+    ~GemmMatrix() { release(); }
+
+    int rows() const { return nRows; }
+    int cols() const { return nCols; }
+    int ld() const { return stride; }
+    bool usesHugePages() const { return huge; }
+
+    T *data() { return storage; }
+    const T *data() const { return storage; }
+    T *row(int i) { return storage + (size_t)i * stride; }
+    const T *row(int i) const { return storage + (size_t)i * stride; }
+    T &operator()(int i, int j) { return storage[(size_t)i * stride + j]; }
+    const T &operator()(int i, int j) const { return storage[(size_t)i * stride + j]; }
+
+    //! Copy rows() x cols() elements from src, whose rows are srcLd apart
+    void assign(const T *src, int srcLd);
+
+    //! Copy the elements out to dst, whose rows are dstLd apart
+    void copyTo(T *dst, int dstLd) const;
+};
+
+//! Leading dimension for rows of cols elements of T: a whole number of cache
+//! lines, plus one more when the row would be a multiple of 512 bytes. Such
+//! strides map the same column of successive rows to a handful of L1 sets,
+//! and packing, which walks down columns, keeps evicting its own lines.
+template <typename T>
+int gemmPaddedLd(int cols);
+
+//! C = alpha * op(A) * op(B) + beta * C on GemmMatrix operands, with the
+//! dimensions taken from the matrices. Returns false, leaving C untouched, if
+//! they don't fit together. Element types as for gemm().
+template <typename In, typename T>
+bool gemm(GemmTranspose transA, GemmTranspose transB, T alpha, const GemmMatrix<In> &A, const GemmMatrix<In> &B,
+          T beta, GemmMatrix<T> &C, ThreadPool *pool = NULL);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+template <typename T>
+int gemmPaddedLd(int cols)
+{
+    const int line = 64 / sizeof(T);
+    int ld = std::max(1, (cols + line - 1) / line) * line;
+    if ((ld * sizeof(T)) % 512 == 0)
+        ld += line;
+    return ld;
+}
+
+template <typename T>
+GemmMatrix<T>::GemmMatrix(int rows, int cols, bool hugePages, bool pad)
+    : storage(NULL), nRows(rows), nCols(cols), stride(pad ? gemmPaddedLd<T>(cols) : cols), bytes(0), mapped(false),
+      huge(false)
+{
+    bytes = (size_t)rows * stride * sizeof(T);
+    if (bytes == 0)
+        return;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages && bytes >= GEMM_HUGE_PAGE)
+    {
+        // Map one spare huge page and trim to a 2 MiB boundary on both sides
+        bytes = (bytes + GEMM_HUGE_PAGE - 1) / GEMM_HUGE_PAGE * GEMM_HUGE_PAGE;
+        void *region = mmap(NULL, bytes + GEMM_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region != MAP_FAILED)
+        {
+            char *base = static_cast<char *>(region);
+            char *aligned = base + (GEMM_HUGE_PAGE - (size_t)base % GEMM_HUGE_PAGE) % GEMM_HUGE_PAGE;
+            if (aligned > base)
+                munmap(base, aligned - base);
+            munmap(aligned + bytes, GEMM_HUGE_PAGE - (aligned - base));
+            mapped = true;
+            huge = madvise(aligned, bytes, MADV_HUGEPAGE) == 0;
+            // Anonymous pages are already zero
+            storage = reinterpret_cast<T *>(aligned);
+            return;
+        }
+        bytes = (size_t)rows * stride * sizeof(T);
+    }
+#else
+    (void)hugePages;
+#endif
+
+    storage = static_cast<T *>(::operator new[](bytes, std::align_val_t(64)));
+    memset(storage, 0, bytes);
+}
+
+template <typename T>
+void GemmMatrix<T>::release()
+{
+    if (!storage)
+        return;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (mapped)
+        munmap(storage, bytes);
+    else
+#endif
+        ::operator delete[](storage, std::align_val_t(64));
+    storage = NULL;
+}
+
+template <typename T>
+GemmMatrix<T>::GemmMatrix(GemmMatrix &&other)
+    : storage(other.storage), nRows(other.nRows), nCols(other.nCols), stride(other.stride), bytes(other.bytes),
+      mapped(other.mapped), huge(other.huge)
+{
+    other.storage = NULL;
+}
+
+template <typename T>
+GemmMatrix<T> &GemmMatrix<T>::operator=(GemmMatrix &&other)
+{
+    if (this != &other)
+    {
+        release();
+        storage = other.storage;
+        nRows = other.nRows;
+        nCols = other.nCols;
+        stride = other.stride;
+        bytes = other.bytes;
+        mapped = other.mapped;
+        huge = other.huge;
+        other.storage = NULL;
+    }
+    return *this;
+}
+
+template <typename T>
+void GemmMatrix<T>::assign(const T *src, int srcLd)
+{
+    for (int i = 0; i < nRows; ++i)
+        memcpy(row(i), src + (size_t)i * srcLd, nCols * sizeof(T));
+}
+
+template <typename T>
+void GemmMatrix<T>::copyTo(T *dst, int dstLd) const
+{
+    for (int i = 0; i < nRows; ++i)
+        memcpy(dst + (size_t)i * dstLd, row(i), nCols * sizeof(T));
+}
+
+template <typename In, typename T>
+bool gemm(GemmTranspose transA, GemmTranspose transB, T alpha, const GemmMatrix<In> &A, const GemmMatrix<In> &B,
+          T beta, GemmMatrix<T> &C, ThreadPool *pool)
+{
+    int m = transA == GemmNoTrans ? A.rows() : A.cols();
+    int k = transA == GemmNoTrans ? A.cols() : A.rows();
+    int kB = transB == GemmNoTrans ? B.rows() : B.cols();
+    int n = transB == GemmNoTrans ? B.cols() : B.rows();
+    if (k != kB || C.rows() != m || C.cols() != n)
+        return false;
+
+    gemm(GemmRowMajor, transA, transB, m, n, k, alpha, A.data(), A.ld(), B.data(), B.ld(), beta, C.data(), C.ld(), pool);
+    return true;
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef GemmSmall_h
+#define GemmSmall_h
+
+#include <cstddef>
+#include <cstring>
+
+// Loops with compile-time trip counts, unrolled completely
+#if defined(__clang__)
+#define GEMM_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define GEMM_UNROLL _Pragma("GCC unroll 64")
+#else
+#define GEMM_UNROLL
+#endif
+
+// One copy per instruction set, picked by the loader for the running CPU
+#if defined(__GNUC__) && !defined(__clang__) && defined(__linux__) && defined(__x86_64__)
+#define GEMM_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define GEMM_TARGET_CLONES
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! C[M x N] = alpha * A[M x K] * B[K x N] + beta * C, row-major, sizes known at compile time
+//! - A row of C is one vector (GCC/Clang vector extension) that stays in registers
+//!   while the K loop, unrolled completely, applies the whole row of A to it;
+//!   no packing and no loop overhead, which dominate at these sizes
+//! - beta == 0 overwrites C without reading it
+//! - T is float or double
+template <int M, int N, int K, typename T>
+void gemmSmall(T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc);
+
+//! gemmSmall<size, size, size> for size 4, 8 or 16, built for AVX-512, AVX2 and the
+//! baseline ISA. Returns false (and does nothing) for any other size.
+bool gemmSmallSquare(int size, double alpha, const double *A, int lda, const double *B, int ldb, double beta,
+                     double *C, int ldc);
+
+//! Same in single precision
+bool gemmSmallSquare(int size, float alpha, const float *A, int lda, const float *B, int ldb, float beta,
+                     float *C, int ldc);
+
+//! Largest dimension for which the unpacked runtime-sized kernel beats the blocked path
+const int GEMM_SMALL_MAX = 64;
+
+//! C[m x n] = alpha * A[m x k] * B[k x n] + beta * C for shapes known only at run time,
+//! without packing: for tiny products copying the operands costs more than it saves.
+//! - Element (i, p) of A is A[i * aRow + p * aCol], so A may be transposed
+//! - B and C are row-major
+//! - Correct for any size, but nothing is blocked for the caches: meant for
+//!   dimensions up to GEMM_SMALL_MAX
+//! - Built for AVX-512, AVX2 and the baseline ISA, like gemmSmallSquare()
+void gemmSmallRows(int m, int n, int k, double alpha, const double *A, size_t aRow, size_t aCol, const double *B,
+                   int ldb, double beta, double *C, int ldc);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+template <int M, int N, int K, typename T>
+inline void gemmSmall(T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc)
+{
+#if defined(__GNUC__)
+    // One row of C (or B) as a single vector; each clone maps it to its own registers
+    typedef T Row __attribute__((vector_size(N * sizeof(T))));
+
+    for (int i = 0; i < M; ++i)
+    {
+        const T *a = A + (size_t)i * lda;
+        Row acc = {};
+
+        GEMM_UNROLL
+        for (int p = 0; p < K; ++p)
+        {
+            Row b;
+            memcpy(&b, B + (size_t)p * ldb, sizeof(Row));
+            acc += a[p] * b;
+        }
+
+        T *c = C + (size_t)i * ldc;
+        acc *= alpha;
+        if (beta != 0)
+        {
+            Row old;
+            memcpy(&old, c, sizeof(Row));
+            acc += beta * old;
+        }
+        memcpy(c, &acc, sizeof(Row));
+    }
+#else
+    for (int i = 0; i < M; ++i)
+    {
+        const T *a = A + (size_t)i * lda;
+        T acc[N] = {};
+        for (int p = 0; p < K; ++p)
+        {
+            const T *b = B + (size_t)p * ldb;
+            for (int j = 0; j < N; ++j)
+                acc[j] += a[p] * b[j];
+        }
+
+        T *c = C + (size_t)i * ldc;
+        for (int j = 0; j < N; ++j)
+            c[j] = beta == 0 ? alpha * acc[j] : alpha * acc[j] + beta * c[j];
+    }
+#endif
+}
+
+GEMM_TARGET_CLONES
+bool gemmSmallSquare(int size, double alpha, const double *A, int lda, const double *B, int ldb, double beta,
+                     double *C, int ldc)
+{
+    switch (size)
+    {
+    case 4:
+        gemmSmall<4, 4, 4>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    case 8:
+        gemmSmall<8, 8, 8>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    case 16:
+        gemmSmall<16, 16, 16>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    }
+    return false;
+}
+
+GEMM_TARGET_CLONES
+bool gemmSmallSquare(int size, float alpha, const float *A, int lda, const float *B, int ldb, float beta,
+                     float *C, int ldc)
+{
+    switch (size)
+    {
+    case 4:
+        gemmSmall<4, 4, 4>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    case 8:
+        gemmSmall<8, 8, 8>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    case 16:
+        gemmSmall<16, 16, 16>(alpha, A, lda, B, ldb, beta, C, ldc);
+        return true;
+    }
+    return false;
+}
+
+GEMM_TARGET_CLONES
+void gemmSmallRows(int m, int n, int k, double alpha, const double *A, size_t aRow, size_t aCol, const double *B,
+                   int ldb, double beta, double *C, int ldc)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        const double *a = A + i * aRow;
+        double *c = C + (size_t)i * ldc;
+        int j = 0;
+#if defined(__GNUC__)
+        // Four columns of the row at a time, the sum over k in one register
+        typedef double Quad __attribute__((vector_size(4 * sizeof(double))));
+        for (; j + 4 <= n; j += 4)
+        {
+            Quad acc = {};
+            for (int p = 0; p < k; ++p)
+            {
+                Quad b;
+                memcpy(&b, B + (size_t)p * ldb + j, sizeof(Quad));
+                acc += a[p * aCol] * b;
+            }
+            acc *= alpha;
+            if (beta != 0.0)
+            {
+                Quad old;
+                memcpy(&old, c + j, sizeof(Quad));
+                acc += beta * old;
+            }
+            memcpy(c + j, &acc, sizeof(Quad));
+        }
+#endif
+        for (; j < n; ++j)
+        {
+            double sum = 0.0;
+            for (int p = 0; p < k; ++p)
+                sum += a[p * aCol] * B[(size_t)p * ldb + j];
+            c[j] = beta == 0.0 ? alpha * sum : alpha * sum + beta * c[j];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef GemmStrassen_h
+#define GemmStrassen_h
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include "Gemm.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Default size at or below which the recursion hands over to the blocked kernel
+const int STRASSEN_CUTOFF = 512;
+
+//! Levels of recursion gemmStrassen() takes for this shape: each level halves m, n
+//! and k, until one of them is at or below the cutoff
+int strassenDepth(int m, int n, int k, int cutoff = STRASSEN_CUTOFF);
+
+//! Doubles of workspace gemmStrassen() needs for this shape and pool
+size_t strassenWorkspaceSize(int m, int n, int k, int cutoff = STRASSEN_CUTOFF, ThreadPool *pool = NULL);
+
+//! C[m x n] = A[m x k] * B[k x n], row-major, by Strassen-Winograd recursion:
+//! 7 half-size products and 15 additions per level instead of 8 products
+//! - Below the cutoff (in any of m, n, k) the blocked kernel takes over
+//! - Odd dimensions peel off their last row, column or depth slice, which gemm() adds back
+//! - The error grows with every level; see strassenDepth()
+//! - All temporaries are carved out of workspace, grown to strassenWorkspaceSize()
+//!   on entry; reserve that up front and the call allocates nothing
+//! - With a pool of up to 7 participants the seven top-level products run
+//!   concurrently, each recursing serially; with more, the products run one
+//!   after another and every leaf uses the whole pool
+void gemmStrassen(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                  PackBuffer<double> &workspace, ThreadPool *pool = NULL, int cutoff = STRASSEN_CUTOFF);
+
+//! Same, with a workspace kept per thread across calls
+void gemmStrassen(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                  ThreadPool *pool = NULL, int cutoff = STRASSEN_CUTOFF);
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+static bool strassenLeaf(int m, int n, int k, int cutoff)
+{
+    return std::min(m, std::min(n, k)) <= std::max(cutoff, 1);
+}
+
+int strassenDepth(int m, int n, int k, int cutoff)
+{
+    int depth = 0;
+    for (; !strassenLeaf(m, n, k, cutoff); ++depth)
+    {
+        m /= 2;
+        n /= 2;
+        k /= 2;
+    }
+    return depth;
+}
+
+//! Workspace of the serial recursion: one m/2 x max(k/2, n/2) and one k/2 x n/2 temporary per level
+static size_t strassenSerialSize(int m, int n, int k, int cutoff)
+{
+    if (strassenLeaf(m, n, k, cutoff))
+        return 0;
+    size_t m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    return m2 * std::max(k2, n2) + k2 * n2 + strassenSerialSize(m2, n2, k2, cutoff);
+}
+
+//! Whether the top-level products run concurrently on this pool
+static bool strassenConcurrent(ThreadPool *pool)
+{
+    return pool && pool->size() > 1 && pool->size() <= 7;
+}
+
+size_t strassenWorkspaceSize(int m, int n, int k, int cutoff, ThreadPool *pool)
+{
+    if (!strassenConcurrent(pool) || strassenLeaf(m, n, k, cutoff))
+        return strassenSerialSize(m, n, k, cutoff);
+
+    // All of S1..S4, T1..T4 live at once, three products go to temporaries
+    // (the other four to the quadrants of C), and every product has its own workspace
+    size_t m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    return 4 * m2 * k2 + 4 * k2 * n2 + 3 * m2 * n2 + 7 * strassenSerialSize(m2, n2, k2, cutoff);
+}
+
+//! Z = X + Y over rows x cols; Z may be X or Y
+static void strassenAdd(int rows, int cols, const double *X, int ldx, const double *Y, int ldy, double *Z, int ldz)
+{
+    for (int i = 0; i < rows; ++i)
+    {
+        const double *x = X + (size_t)i * ldx, *y = Y + (size_t)i * ldy;
+        double *z = Z + (size_t)i * ldz;
+        for (int j = 0; j < cols; ++j)
+            z[j] = x[j] + y[j];
+    }
+}
+
+//! Z = X - Y over rows x cols; Z may be X or Y
+static void strassenSub(int rows, int cols, const double *X, int ldx, const double *Y, int ldy, double *Z, int ldz)
+{
+    for (int i = 0; i < rows; ++i)
+    {
+        const double *x = X + (size_t)i * ldx, *y = Y + (size_t)i * ldy;
+        double *z = Z + (size_t)i * ldz;
+        for (int j = 0; j < cols; ++j)
+            z[j] = x[j] - y[j];
+    }
+}
+
+//! Add back the slices the even-sized core left out, for odd m, n or k
+static void strassenPeel(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                         ThreadPool *pool)
+{
+    const int me = m & ~1, ne = n & ~1;
+    if (k & 1)
+        gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, me, ne, 1, 1.0, A + (k - 1), lda, B + (size_t)(k - 1) * ldb, ldb,
+             1.0, C, ldc, pool);
+    if (n & 1)
+        gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, me, 1, k, 1.0, A, lda, B + (n - 1), ldb, 0.0, C + (n - 1), ldc,
+             pool);
+    if (m & 1)
+        gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, 1, n, k, 1.0, A + (size_t)(m - 1) * lda, lda, B, ldb, 0.0,
+             C + (size_t)(m - 1) * ldc, ldc, pool);
+}
+
+//! One thread's recursion, with two temporaries per level (the schedule of Boyer,
+//! Dumas, Pernet and Zhou); the quadrants of C hold the other intermediate results.
+//! Leaves go to gemm() on leafPool.
+static void strassenSerial(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C,
+                           int ldc, double *work, ThreadPool *leafPool, int cutoff)
+{
+    if (strassenLeaf(m, n, k, cutoff))
+    {
+        gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, 1.0, A, lda, B, ldb, 0.0, C, ldc, leafPool);
+        return;
+    }
+
+    const int m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    const double *A11 = A, *A12 = A + k2, *A21 = A + (size_t)m2 * lda, *A22 = A21 + k2;
+    const double *B11 = B, *B12 = B + n2, *B21 = B + (size_t)k2 * ldb, *B22 = B21 + n2;
+    double *C11 = C, *C12 = C + n2, *C21 = C + (size_t)m2 * ldc, *C22 = C21 + n2;
+
+    // X holds an m2 x k2 sum of A, later the m2 x n2 product P1; Y a k2 x n2 sum of B
+    double *X = work, *Y = X + (size_t)m2 * std::max(k2, n2), *next = Y + (size_t)k2 * n2;
+    auto product = [&](const double *P, int ldp, const double *Q, int ldq, double *R, int ldr)
+    { strassenSerial(m2, n2, k2, P, ldp, Q, ldq, R, ldr, next, leafPool, cutoff); };
+
+    strassenSub(m2, k2, A11, lda, A21, lda, X, k2);     // S3
+    strassenSub(k2, n2, B22, ldb, B12, ldb, Y, n2);     // T3
+    product(X, k2, Y, n2, C21, ldc);                    // P7
+    strassenAdd(m2, k2, A21, lda, A22, lda, X, k2);     // S1
+    strassenSub(k2, n2, B12, ldb, B11, ldb, Y, n2);     // T1
+    product(X, k2, Y, n2, C22, ldc);                    // P5
+    strassenSub(m2, k2, X, k2, A11, lda, X, k2);        // S2
+    strassenSub(k2, n2, B22, ldb, Y, n2, Y, n2);        // T2
+    product(X, k2, Y, n2, C12, ldc);                    // P6
+    strassenSub(m2, k2, A12, lda, X, k2, X, k2);        // S4
+    product(X, k2, B22, ldb, C11, ldc);                 // P3
+    product(A11, lda, B11, ldb, X, n2);                 // P1
+    strassenAdd(m2, n2, X, n2, C12, ldc, C12, ldc);     // U2 = P1 + P6
+    strassenAdd(m2, n2, C12, ldc, C21, ldc, C21, ldc);  // U3 = U2 + P7
+    strassenAdd(m2, n2, C12, ldc, C22, ldc, C12, ldc);  // U4 = U2 + P5
+    strassenAdd(m2, n2, C21, ldc, C22, ldc, C22, ldc);  // C22 = U3 + P5
+    strassenAdd(m2, n2, C12, ldc, C11, ldc, C12, ldc);  // C12 = U4 + P3
+    strassenSub(k2, n2, Y, n2, B21, ldb, Y, n2);        // T4
+    product(A22, lda, Y, n2, C11, ldc);                 // P4
+    strassenSub(m2, n2, C21, ldc, C11, ldc, C21, ldc);  // C21 = U3 - P4
+    product(A12, lda, B21, ldb, C11, ldc);              // P2
+    strassenAdd(m2, n2, X, n2, C11, ldc, C11, ldc);     // C11 = P1 + P2
+
+    strassenPeel(m, n, k, A, lda, B, ldb, C, ldc, leafPool);
+}
+
+//! body(first, last) over [0, rows) in about four slices per participant
+static void strassenRows(ThreadPool &pool, int rows, const std::function<void(int, int)> &body)
+{
+    int slices = std::min(rows, 4 * pool.size());
+    pool.parallelFor(slices, [&](int s, int)
+                     { body((int)((long)rows * s / slices), (int)((long)rows * (s + 1) / slices)); });
+}
+
+//! Top level with all intermediate sums in their own buffers, so the seven
+//! products are independent and run concurrently on the pool
+static void strassenConcurrentTop(ThreadPool &pool, int m, int n, int k, const double *A, int lda, const double *B,
+                                  int ldb, double *C, int ldc, double *work, int cutoff)
+{
+    const int m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    const double *A11 = A, *A12 = A + k2, *A21 = A + (size_t)m2 * lda, *A22 = A21 + k2;
+    const double *B11 = B, *B12 = B + n2, *B21 = B + (size_t)k2 * ldb, *B22 = B21 + n2;
+    double *C11 = C, *C12 = C + n2, *C21 = C + (size_t)m2 * ldc, *C22 = C21 + n2;
+
+    const size_t sa = (size_t)m2 * k2, sb = (size_t)k2 * n2, sc = (size_t)m2 * n2;
+    double *S1 = work, *S2 = S1 + sa, *S3 = S2 + sa, *S4 = S3 + sa;
+    double *T1 = S4 + sa, *T2 = T1 + sb, *T3 = T2 + sb, *T4 = T3 + sb;
+    double *W1 = T4 + sb, *W5 = W1 + sc, *W6 = W5 + sc, *next = W6 + sc;
+    const size_t childWork = strassenSerialSize(m2, n2, k2, cutoff);
+
+    // Sums: each row of S (T) only depends on the same row of A (B)
+    strassenRows(pool, m2 + k2, [&](int first, int last)
+                 {
+                     for (int i = first; i < last; ++i)
+                     {
+                         if (i < m2)
+                         {
+                             size_t a = (size_t)i * lda, s = (size_t)i * k2;
+                             strassenAdd(1, k2, A21 + a, lda, A22 + a, lda, S1 + s, k2);
+                             strassenSub(1, k2, S1 + s, k2, A11 + a, lda, S2 + s, k2);
+                             strassenSub(1, k2, A11 + a, lda, A21 + a, lda, S3 + s, k2);
+                             strassenSub(1, k2, A12 + a, lda, S2 + s, k2, S4 + s, k2);
+                         }
+                         else
+                         {
+                             size_t b = (size_t)(i - m2) * ldb, t = (size_t)(i - m2) * n2;
+                             strassenSub(1, n2, B12 + b, ldb, B11 + b, ldb, T1 + t, n2);
+                             strassenSub(1, n2, B22 + b, ldb, T1 + t, n2, T2 + t, n2);
+                             strassenSub(1, n2, B22 + b, ldb, B12 + b, ldb, T3 + t, n2);
+                             strassenSub(1, n2, T2 + t, n2, B21 + b, ldb, T4 + t, n2);
+                         }
+                     }
+                 });
+
+    // Products: P1, P5, P6 to temporaries, the rest straight into the quadrants of C
+    struct Product
+    {
+        const double *P;
+        int ldp;
+        const double *Q;
+        int ldq;
+        double *R;
+        int ldr;
+    };
+    const Product products[7] = {
+        {A11, lda, B11, ldb, W1, n2},   // P1
+        {A12, lda, B21, ldb, C11, ldc}, // P2
+        {S4, k2, B22, ldb, C12, ldc},   // P3
+        {A22, lda, T4, n2, C21, ldc},   // P4
+        {S1, k2, T1, n2, W5, n2},       // P5
+        {S2, k2, T2, n2, W6, n2},       // P6
+        {S3, k2, T3, n2, C22, ldc},     // P7
+    };
+    pool.parallelFor(7, [&](int i, int)
+                     {
+                         const Product &p = products[i];
+                         strassenSerial(m2, n2, k2, p.P, p.ldp, p.Q, p.ldq, p.R, p.ldr, next + i * childWork, NULL, cutoff);
+                     });
+
+    // Combine, row by row
+    strassenRows(pool, m2, [&](int first, int last)
+                 {
+                     int rows = last - first;
+                     size_t c = (size_t)first * ldc, w = (size_t)first * n2;
+                     strassenAdd(rows, n2, C11 + c, ldc, W1 + w, n2, C11 + c, ldc);    // C11 = P1 + P2
+                     strassenAdd(rows, n2, W6 + w, n2, W1 + w, n2, W6 + w, n2);        // U2 = P1 + P6
+                     strassenAdd(rows, n2, C22 + c, ldc, W6 + w, n2, C22 + c, ldc);    // U3 = U2 + P7
+                     strassenAdd(rows, n2, W6 + w, n2, W5 + w, n2, W6 + w, n2);        // U4 = U2 + P5
+                     strassenAdd(rows, n2, C12 + c, ldc, W6 + w, n2, C12 + c, ldc);    // C12 = U4 + P3
+                     strassenSub(rows, n2, C22 + c, ldc, C21 + c, ldc, C21 + c, ldc);  // C21 = U3 - P4
+                     strassenAdd(rows, n2, C22 + c, ldc, W5 + w, n2, C22 + c, ldc);    // C22 = U3 + P5
+                 });
+
+    strassenPeel(m, n, k, A, lda, B, ldb, C, ldc, &pool);
+}
+
+void gemmStrassen(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                  PackBuffer<double> &workspace, ThreadPool *pool, int cutoff)
+{
+    if (m <= 0 || n <= 0)
+        return;
+
+    double *work = workspace.get(std::max<size_t>(1, strassenWorkspaceSize(m, n, k, cutoff, pool)));
+    if (strassenConcurrent(pool) && !strassenLeaf(m, n, k, cutoff))
+        strassenConcurrentTop(*pool, m, n, k, A, lda, B, ldb, C, ldc, work, cutoff);
+    else
+        strassenSerial(m, n, k, A, lda, B, ldb, C, ldc, work, pool, cutoff);
+}
+
+void gemmStrassen(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                  ThreadPool *pool, int cutoff)
+{
+    static thread_local PackBuffer<double> workspace;
+    gemmStrassen(m, n, k, A, lda, B, ldb, C, ldc, workspace, pool, cutoff);
+}
+
+#endif
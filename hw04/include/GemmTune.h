@@ -0,0 +1,296 @@
+#ifndef GemmTune_h
+#define GemmTune_h
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Gemm.h"
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! Seconds per call of the given function, measured however the caller likes
+typedef std::function<double(const std::function<void()> &)> GemmTimer;
+
+//! What the autotuner found for one element type
+struct GemmTuning
+{
+    std::string type;                                            // "double" or "float"
+    std::string kernel;                                          // The fastest kernel
+    double seconds;                                              // Its time on the tuning product
+    std::vector<std::pair<std::string, GemmBlocking>> blockings; // Best blocking of every kernel tried
+};
+
+//! Identifies this machine in the tuning file: CPU model, cache sizes and hardware threads
+std::string gemmMachineId();
+
+//! The tuning file: $GEMM_TUNING_FILE if set, else gemm_tuning.txt in the working directory
+std::string gemmTuningPath();
+
+//! Timings per candidate blocking, of which the median counts
+#define GEMM_TUNE_REPS 5
+
+//! Relative improvement a candidate needs over the best blocking so far
+#define GEMM_TUNE_MARGIN 0.03
+
+//! Search the blocking of every kernel this CPU supports for element type T, timing
+//! an m x n x k product with timer for each candidate
+//! - Coordinate descent from cacheBlocking(): kc, then mc, then nc over fixed candidate
+//!   lists on one thread (they only depend on the caches); then, with a pool of more
+//!   than one thread, tiles per participant on the pool
+//! - Candidates are clamped to the product's k, m and n: larger blocks run the same
+//!   code, and only timing noise would tell them apart
+//! - Each candidate is timed GEMM_TUNE_REPS times and judged by the median; it has to
+//!   beat the best so far by GEMM_TUNE_MARGIN to replace it
+//! - Every kernel's best blocking goes to setTunedBlocking(), and the fastest kernel
+//!   becomes the active one for T
+template <typename T>
+GemmTuning autotuneGemm(int m, int n, int k, const GemmTimer &timer, ThreadPool *pool = NULL);
+
+//! Replace this machine's lines of the tuning file with the results; lines of
+//! other machines are kept. Returns false if the file can't be written.
+bool saveGemmTuning(const std::vector<GemmTuning> &tunings, const std::string &path = gemmTuningPath());
+
+//! Apply this machine's lines of the tuning file: the blocking of each kernel and
+//! the fastest kernel per element type. Returns false, leaving the heuristic
+//! defaults, if the file has none. Call it before options such as --kernel are
+//! applied, so they still override the tuned kernel.
+bool loadGemmTuning(const std::string &path = gemmTuningPath());
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+std::string gemmMachineId()
+{
+    std::string model = "unknown CPU";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos)
+        {
+            model = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+
+    std::ostringstream id;
+    id << model;
+#if defined(__linux__)
+    id << ", L1 " << sysconf(_SC_LEVEL1_DCACHE_SIZE) / 1024 << "K, L2 " << sysconf(_SC_LEVEL2_CACHE_SIZE) / 1024
+       << "K, L3 " << sysconf(_SC_LEVEL3_CACHE_SIZE) / 1024 << "K";
+#endif
+    id << ", " << std::thread::hardware_concurrency() << " threads";
+
+    // The tab separates the machine from the rest of a line
+    std::string result = id.str();
+    std::replace(result.begin(), result.end(), '\t', ' ');
+    return result;
+}
+
+std::string gemmTuningPath()
+{
+    const char *path = getenv("GEMM_TUNING_FILE");
+    return path && *path ? path : "gemm_tuning.txt";
+}
+
+template <typename T>
+static const char *gemmTypeName()
+{
+    return sizeof(T) == sizeof(float) ? "float" : "double";
+}
+
+//! v rounded up to a whole multiple of step, but no larger than limit rounded up
+static int gemmTuneRound(int v, int step, int limit)
+{
+    int rounded = std::max(1, (v + step - 1) / step) * step;
+    return std::min(rounded, std::max(1, (limit + step - 1) / step) * step);
+}
+
+//! Candidates rounded by gemmTuneRound(), without duplicates
+static std::vector<int> gemmTuneCandidates(std::initializer_list<int> values, int step, int limit)
+{
+    std::vector<int> result;
+    for (int v : values)
+    {
+        int rounded = gemmTuneRound(v, step, limit);
+        if (std::find(result.begin(), result.end(), rounded) == result.end())
+            result.push_back(rounded);
+    }
+    return result;
+}
+
+template <typename T>
+GemmTuning autotuneGemm(int m, int n, int k, const GemmTimer &timer, ThreadPool *pool)
+{
+    // Values don't change the timing; ones keep C free of overflow
+    std::vector<T> A((size_t)m * k, T(1)), B((size_t)k * n, T(1)), C((size_t)m * n);
+
+    GemmTuning result;
+    result.type = gemmTypeName<T>();
+    result.seconds = 0;
+
+    int count;
+    const GemmKernelT<T> *kernels = gemmKernels<T>(&count);
+    for (int i = 0; i < count; ++i)
+    {
+        const GemmKernelT<T> &kernel = kernels[i];
+        if (!gemmKernelSupported(kernel))
+            continue;
+
+        auto time = [&](const GemmBlocking &b, ThreadPool *on)
+        {
+            double reps[GEMM_TUNE_REPS];
+            for (int r = 0; r < GEMM_TUNE_REPS; ++r)
+                reps[r] = timer([&]()
+                                { gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, T(1), A.data(), k, B.data(), n,
+                                       T(0), C.data(), n, on, kernel, b); });
+            std::nth_element(reps, reps + GEMM_TUNE_REPS / 2, reps + GEMM_TUNE_REPS);
+            return reps[GEMM_TUNE_REPS / 2];
+        };
+
+        // The heuristic may start above the product's size, too
+        GemmBlocking best = cacheBlocking(kernel);
+        best.kc = gemmTuneRound(best.kc, 1, k);
+        best.mc = gemmTuneRound(best.mc, kernel.mr, m);
+        best.nc = gemmTuneRound(best.nc, kernel.nr, n);
+        double bestTime = time(best, NULL);
+        auto descend = [&](int GemmBlocking::*field, const std::vector<int> &candidates, ThreadPool *on)
+        {
+            if (on)
+                bestTime = time(best, on);
+            for (int value : candidates)
+            {
+                if (value == best.*field)
+                    continue;
+                GemmBlocking b = best;
+                b.*field = value;
+                double t = time(b, on);
+                if (t < bestTime * (1 - GEMM_TUNE_MARGIN))
+                {
+                    best = b;
+                    bestTime = t;
+                }
+            }
+        };
+
+        descend(&GemmBlocking::kc, gemmTuneCandidates({64, 128, 192, 256, 384, 512}, 1, k), NULL);
+        descend(&GemmBlocking::mc, gemmTuneCandidates({48, 96, 144, 192, 288, 384, 576, 768, 1024}, kernel.mr, m), NULL);
+        descend(&GemmBlocking::nc, gemmTuneCandidates({256, 512, 1024, 2048, 4096, 8192}, kernel.nr, n), NULL);
+        double serialTime = bestTime;
+        if (pool && pool->size() > 1)
+            descend(&GemmBlocking::tiles, gemmTuneCandidates({1, 2, 4, 8, 16}, 1, 16), pool);
+
+        setTunedBlocking(kernel, best);
+        result.blockings.push_back(std::make_pair(std::string(kernel.name), best));
+
+        // Kernels are ranked on one thread, like the cache parameters
+        if (result.kernel.empty() || serialTime < result.seconds)
+        {
+            result.kernel = kernel.name;
+            result.seconds = serialTime;
+        }
+    }
+
+    forceGemmKernel<T>(result.kernel.c_str());
+    return result;
+}
+
+bool saveGemmTuning(const std::vector<GemmTuning> &tunings, const std::string &path)
+{
+    const std::string machine = gemmMachineId();
+
+    // Keep what other machines recorded
+    std::vector<std::string> kept;
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && line[0] != '#' && line.compare(0, machine.size() + 1, machine + "\t") != 0)
+                kept.push_back(line);
+        }
+    }
+
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+    out << "# GEMM autotuning results, one machine per group of lines:" << std::endl;
+    out << "# <machine>\\t<type> kernel <name>" << std::endl;
+    out << "# <machine>\\t<type> blocking <kernel> <mc> <kc> <nc> <tiles>" << std::endl;
+    for (const std::string &line : kept)
+        out << line << std::endl;
+    for (const GemmTuning &tuning : tunings)
+    {
+        out << machine << "\t" << tuning.type << " kernel " << tuning.kernel << std::endl;
+        for (const auto &entry : tuning.blockings)
+        {
+            const GemmBlocking &b = entry.second;
+            out << machine << "\t" << tuning.type << " blocking " << entry.first << " " << b.mc << " " << b.kc << " "
+                << b.nc << " " << b.tiles << std::endl;
+        }
+    }
+    return out.good();
+}
+
+//! Record the blocking for the named kernel of T, if this build has it
+template <typename T>
+static bool applyTunedBlocking(const std::string &name, const GemmBlocking &blocking)
+{
+    int count;
+    const GemmKernelT<T> *kernels = gemmKernels<T>(&count);
+    for (int i = 0; i < count; ++i)
+    {
+        if (name == kernels[i].name)
+        {
+            setTunedBlocking(kernels[i], blocking);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool loadGemmTuning(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+        return false;
+
+    const std::string prefix = gemmMachineId() + "\t";
+    bool found = false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        std::istringstream fields(line.substr(prefix.size()));
+        std::string type, what, kernel;
+        fields >> type >> what >> kernel;
+        const bool single = type == "float";
+        if (!fields || (!single && type != "double"))
+            continue;
+
+        if (what == "kernel")
+        {
+            // A kernel this CPU can't run (or this build lacks) leaves the cpuid choice
+            found |= single ? forceGemmKernel<float>(kernel.c_str()) : forceGemmKernel<double>(kernel.c_str());
+        }
+        else if (what == "blocking")
+        {
+            GemmBlocking b;
+            if (!(fields >> b.mc >> b.kc >> b.nc >> b.tiles) || b.mc <= 0 || b.kc <= 0 || b.nc <= 0 || b.tiles <= 0)
+                continue;
+            found |= single ? applyTunedBlocking<float>(kernel, b) : applyTunedBlocking<double>(kernel, b);
+        }
+    }
+    return found;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#define POOL_PAUSE() _mm_pause()
+#else
+#define POOL_PAUSE() ((void)0)
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//+--------------------------------------------------------------------------------+
+//|                                Declaration                                     |
+//+--------------------------------------------------------------------------------+
+//! A persistent fork-join pool for data-parallel loops
+//! - Workers are created once and live as long as the pool, so a parallel loop
+//!   costs a counter bump and a wake-up instead of creating threads
+//! - Idle workers spin for a short while before sleeping, so back-to-back loops
+//!   (e.g. many small multiplications) are picked up within microseconds
+//! - Indices are handed out in chunks from one atomic counter: a participant that
+//!   finishes early simply takes the next chunk
+//! - The calling thread takes part as the last participant, so a pool of size 1
+//!   spawns no thread and runs everything serially
+//! - One loop runs at a time: the pool holds a single loop's state
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::mutex callLock;              // Held by the thread whose loop the workers run
+    std::condition_variable wake;
+    std::atomic<unsigned> generation; // Bumped once per loop (and on shutdown)
+    std::atomic<int> nextIndex;
+    std::atomic<int> active;          // Workers still inside the current loop
+    std::atomic<bool> stop;
+    const std::function<void(int, int)> *body;
+    int count, chunk;
+    int spinLimit;
+
+    void workerLoop(int id, int cpu);
+
+    //! Take chunks of the current loop until none are left
+    void runChunks(int id);
+
+public:
+    //! nThreads == 0 means one participant per hardware thread.
+    //! With pin, participant i is bound to the i-th CPU this process may run on.
+    explicit ThreadPool(unsigned nThreads = 0, bool pin = false);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int)workers.size() + 1; }
+
+    //! body(index, participant) for every index in [0, count), in chunks of
+    //! `chunk` consecutive indices. Returns when all of them have finished.
+    //! - Calls from threads outside the pool take turns: a second caller waits
+    //!   until the running loop has finished
+    //! - A call from inside a body of this pool (e.g. gemm() on the same pool in
+    //!   a task) runs serially on the calling participant, with its id
+    void parallelFor(int count, const std::function<void(int, int)> &body, int chunk = 1);
+};
+
+
+//+--------------------------------------------------------------------------------+
+//|                               Implementation                                   |
+//+--------------------------------------------------------------------------------+
+//! The pool whose loop this thread is running a body of, and its participant id
+static thread_local const ThreadPool *poolOfThisThread = NULL;
+static thread_local int participantOfThisThread = 0;
+
+//! CPUs this process may run on, in order
+static std::vector<int> allowedCPUs()
+{
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+        {
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+        }
+    }
+#endif
+    return cpus;
+}
+
+static void pinCurrentThread(int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+ThreadPool::ThreadPool(unsigned nThreads, bool pin)
+    : generation(0), nextIndex(0), active(0), stop(false), body(NULL), count(0), chunk(1)
+{
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    if (nThreads == 0)
+        nThreads = hardware;
+
+    // Spinning only pays off when every participant has a core of its own
+    spinLimit = nThreads <= hardware ? 20000 : 0;
+
+    std::vector<int> cpus;
+    if (pin)
+        cpus = allowedCPUs();
+    auto cpuFor = [&cpus](unsigned i) { return cpus.empty() ? -1 : cpus[i % cpus.size()]; };
+
+    for (unsigned i = 0; i + 1 < nThreads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, (int)i, cpuFor(i));
+
+    // The last participant is the thread that calls parallelFor()
+    if (pin)
+        pinCurrentThread(cpuFor(nThreads - 1));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        generation++;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers)
+        w.join();
+}
+
+void ThreadPool::runChunks(int id)
+{
+    for (;;)
+    {
+        int begin = nextIndex.fetch_add(chunk, std::memory_order_relaxed);
+        if (begin >= count)
+            return;
+        int end = std::min(begin + chunk, count);
+        for (int i = begin; i < end; ++i)
+            (*body)(i, id);
+    }
+}
+
+void ThreadPool::workerLoop(int id, int cpu)
+{
+    pinCurrentThread(cpu);
+    poolOfThisThread = this;
+    participantOfThisThread = id;
+
+    unsigned seen = 0;
+    for (;;)
+    {
+        unsigned current = generation.load(std::memory_order_acquire);
+        for (int spin = 0; current == seen && spin < spinLimit; ++spin)
+        {
+            POOL_PAUSE();
+            current = generation.load(std::memory_order_acquire);
+        }
+        if (current == seen)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            wake.wait(lk, [this, seen] { return generation.load(std::memory_order_acquire) != seen; });
+            current = generation.load(std::memory_order_acquire);
+        }
+        seen = current;
+
+        if (stop)
+            return;
+
+        runChunks(id);
+        active.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)> &body, int chunk)
+{
+    if (count <= 0)
+        return;
+    chunk = std::max(1, chunk);
+
+    // Nested in one of our own loops: the other participants are busy with it
+    if (poolOfThisThread == this)
+    {
+        for (int i = 0; i < count; ++i)
+            body(i, participantOfThisThread);
+        return;
+    }
+
+    // Not worth waking anyone
+    if (workers.empty() || count <= chunk)
+    {
+        for (int i = 0; i < count; ++i)
+            body(i, size() - 1);
+        return;
+    }
+
+    std::lock_guard<std::mutex> turn(callLock);
+    const ThreadPool *outerPool = poolOfThisThread;
+    const int outerParticipant = participantOfThisThread;
+    poolOfThisThread = this;
+    participantOfThisThread = size() - 1;
+
+    this->body = &body;
+    this->count = count;
+    this->chunk = chunk;
+    nextIndex.store(0, std::memory_order_relaxed);
+    active.store((int)workers.size(), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    runChunks(size() - 1);
+
+    // Workers leave the loop right after their last chunk, so this is short
+    for (int spin = 0; active.load(std::memory_order_acquire) != 0; ++spin)
+    {
+        if (spin < spinLimit)
+            POOL_PAUSE();
+        else
+            std::this_thread::yield();
+    }
+
+    poolOfThisThread = outerPool;
+    participantOfThisThread = outerParticipant;
+}
+
+#endif
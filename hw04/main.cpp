@@ -8,28 +8,49 @@
 #include <functional>
 #include <algorithm>
 #include <fstream>
+#include <limits>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include "Gemm.h"
+#include "GemmBatch.h"
+#include "GemmBench.h"
+#include "GemmMatrix.h"
+#include "GemmStrassen.h"
+#include "GemmTune.h"
 
 using namespace std;
 
-const int m = 1200;
-const int n = 1100;
-const int k = 1000;
-
 using Matrix = vector<double>;
+using MatrixF = vector<float>;
 
-void matrixInit(Matrix &mat, int rows, int cols)
+// splitmix64's finalizer: every bit of x affects every bit of the result
+static inline uint64_t mix64(uint64_t x)
 {
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_real_distribution<> dis(0, 10);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
-    for (int i = 0; i < rows * cols; ++i)
-    {
-        mat[i] = dis(gen);
-    }
+// Uniform [0, 10) elements, each a hash of (seed, stream, index) instead of the next
+// draw of one generator, so slices fill in parallel and a seed gives the same matrix
+// on any number of threads. Every matrix of a run takes its own stream.
+void matrixInit(ThreadPool &pool, Matrix &mat, int rows, int cols, uint64_t seed, uint64_t stream)
+{
+    const size_t count = (size_t)rows * cols;
+    const size_t slice = (size_t)1 << 16;
+    const uint64_t key = mix64(seed ^ mix64(stream + 0x9E3779B97F4A7C15ull));
+    double *data = mat.data();
+    pool.parallelFor((int)((count + slice - 1) / slice), [&](int s, int)
+                     {
+                         size_t last = min(count, (s + 1) * slice);
+                         for (size_t i = s * slice; i < last; ++i)
+                             data[i] = 10.0 * (double)(mix64(key + i * 0x9E3779B97F4A7C15ull) >> 11) * 0x1.0p-53;
+                     });
 }
 
-void sequentialMultiplication(const Matrix &A, const Matrix &B, Matrix &C)
+// Naive triple loop; the reference every other path is verified against
+void sequentialMultiplication(const Matrix &A, const Matrix &B, Matrix &C, int m, int n, int k)
 {
     fill(C.begin(), C.end(), 0);
 
@@ -47,64 +68,277 @@ void sequentialMultiplication(const Matrix &A, const Matrix &B, Matrix &C)
     }
 }
 
-void singleRowMultiplication(const Matrix &A, const Matrix &B, Matrix &C, int start_row, int end_row)
+// Cache-blocked, packed multiplication with a register-blocked microkernel (see Gemm.h)
+void blockedMultiplication(const Matrix &A, const Matrix &B, Matrix &C, int m, int n, int k)
 {
-    for (int i = start_row; i < end_row; ++i)
+    gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, 1.0, A.data(), k, B.data(), n, 0.0, C.data(), n);
+}
+
+// C split into 2D tiles handed out by the persistent pool, each with the blocked kernel.
+// In is the element type of A and B, T that of C: double/double, float/float or float/double.
+template <typename In, typename T>
+void parallelMultiplication(ThreadPool &pool, const vector<In> &A, const vector<In> &B, vector<T> &C, int m, int n, int k)
+{
+    gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, m, n, k, T(1), A.data(), k, B.data(), n, T(0), C.data(), n, &pool);
+}
+
+// Average seconds per call of f over enough calls to fill about 0.2 seconds
+double timeSmall(const function<void()> &f)
+{
+    f();
+    int calls = 0;
+    auto start = chrono::high_resolution_clock::now();
+    chrono::duration<double> elapsed(0);
+    do
     {
-        for (int j = 0; j < n; ++j)
-        {
-            double sum = 0.0;
-            for (int z = 0; z < k; ++z)
-            {
-                sum += A[i * k + z] * B[z * n + j];
-            }
-            C[i * n + j] = sum;
-        }
+        for (int i = 0; i < 100; ++i)
+            f();
+        calls += 100;
+        elapsed = chrono::high_resolution_clock::now() - start;
+    } while (elapsed.count() < 0.2);
+    return elapsed.count() / calls;
+}
+
+// Average seconds per call of f, doubling the calls until they fill about 0.2 seconds;
+// for calls too long to repeat a hundred times, such as large batches
+double timeBatch(const function<void()> &f)
+{
+    f();
+    int calls = 0;
+    auto start = chrono::high_resolution_clock::now();
+    chrono::duration<double> elapsed(0);
+    for (int round = 1; elapsed.count() < 0.2; round *= 2)
+    {
+        for (int i = 0; i < round; ++i)
+            f();
+        calls += round;
+        elapsed = chrono::high_resolution_clock::now() - start;
     }
+    return elapsed.count() / calls;
 }
 
-void parallelMultiplication(const Matrix &A, const Matrix &B, Matrix &C)
+// Average seconds per call of f over the given number of rounds
+double timeRounds(const function<void()> &f, int rounds)
 {
-    fill(C.begin(), C.end(), 0);
-    unsigned int num_threads = thread::hardware_concurrency();
+    double total = 0.0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        f();
+        chrono::duration<double> duration = chrono::high_resolution_clock::now() - start;
+        total += duration.count();
+    }
+    return total / rounds;
+}
 
-    vector<thread> threads;
+// 2mnk floating point operations per multiplication
+double gflops(double seconds, int m, int n, int k)
+{
+    return 2.0 * m * n * k / seconds / 1e9;
+}
 
-    int rows_per_thread = m / num_threads;
-    int remainder = m % num_threads;
+// Relative error a k-term product may show against the double reference: k roundings
+// in the accumulating type T (twice, as the reference has its own), plus the rounding
+// of each input to In
+template <typename In, typename T>
+double tolerance(int k)
+{
+    return 2.0 * k * numeric_limits<T>::epsilon() + 2.0 * numeric_limits<In>::epsilon();
+}
 
-    int start_row = 0;
-    for (unsigned int i = 0; i < num_threads; ++i)
+// Largest |reference - result| and |reference| over [first, last). A NaN sticks,
+// so a broken result can't pass as a small error.
+template <typename T>
+static void maxAbs(const double *reference, const T *result, size_t first, size_t last, double *error, double *scale)
+{
+    double e = 0, s = 0;
+    size_t i = first;
+#if defined(__GNUC__)
+    // Four elements at a time, float results widened in the register
+    typedef double Quad __attribute__((vector_size(4 * sizeof(double))));
+    typedef T QuadT __attribute__((vector_size(4 * sizeof(T))));
+    Quad qe = {}, qs = {};
+    for (; i + 4 <= last; i += 4)
     {
-        int end_row = start_row + rows_per_thread + (i < remainder ? 1 : 0);
-
-        threads.emplace_back(singleRowMultiplication, cref(A), cref(B), ref(C), start_row, end_row);
-        start_row = end_row;
+        Quad r;
+        QuadT x;
+        memcpy(&r, reference + i, sizeof(Quad));
+        memcpy(&x, result + i, sizeof(QuadT));
+        Quad d = r - __builtin_convertvector(x, Quad);
+        d = d < 0 ? -d : d;
+        r = r < 0 ? -r : r;
+        qe = (d > qe) | (d != d) ? d : qe;
+        qs = r > qs ? r : qs;
+    }
+    for (int j = 0; j < 4; ++j)
+    {
+        e = qe[j] > e || qe[j] != qe[j] ? qe[j] : e;
+        s = max(s, qs[j]);
+    }
+#endif
+    for (; i < last && e == e; ++i)
+    {
+        double d = fabs(reference[i] - (double)result[i]);
+        e = d > e || d != d ? d : e;
+        s = max(s, fabs(reference[i]));
     }
+    *error = e;
+    *scale = s;
+}
+
+// Largest difference from the reference relative to its largest element (normwise,
+// so elements near zero don't inflate it), reduced over slices on the pool
+template <typename T>
+double relativeError(ThreadPool &pool, const Matrix &reference, const vector<T> &result)
+{
+    const size_t count = reference.size();
+    const int slices = (int)max<size_t>(1, min<size_t>(4 * pool.size(), count >> 14));
+    vector<double> error(slices), scale(slices);
+    pool.parallelFor(slices, [&](int s, int)
+                     { maxAbs(reference.data(), result.data(), count * s / slices, count * (s + 1) / slices, &error[s], &scale[s]); });
 
-    for (auto &t : threads)
+    double e = 0, s = 0;
+    for (int i = 0; i < slices; ++i)
     {
-        t.join();
+        e = error[i] > e || error[i] != error[i] ? error[i] : e;
+        s = max(s, scale[i]);
     }
+    return s > 0 ? e / s : e;
+}
+
+// relativeError() checked against the tolerance
+template <typename T>
+bool verification(ThreadPool &pool, const string &name, const Matrix &reference, const vector<T> &result, double tol)
+{
+    double relative = relativeError(pool, reference, result);
+    bool passed = relative <= tol;
+    cout << "Verification " << (passed ? "Passed" : "FAILED") << " (" << name << ")! Relative error: " << relative
+         << " (tolerance " << tol << ")" << endl;
+    return passed;
 }
 
-bool verification(const Matrix &sequential, const Matrix &parallel)
+int main(int argc, char **argv)
 {
-    double error = 0;
-    for (int i = 0; i < m * n; ++i)
+    // --kernel=scalar|sse2|avx2|avx512 overrides the microkernel picked from cpuid
+    // --threads=N sets the pool size (default: one per hardware thread)
+    // --pin binds every pool thread to its own CPU
+    // --size=MxNxK sets the matrix dimensions (default 1200x1100x1000)
+    // --strassen[=cutoff] also runs the Strassen-Winograd recursion (default cutoff 512)
+    // --autotune searches the blocking on this machine first and saves it to the tuning
+    //   file ($GEMM_TUNING_FILE or gemm_tuning.txt), which later runs load at startup
+    // --bench runs the benchmark suite instead (shapes x 1..N threads x kernels x precisions)
+    //   and writes hw04Bench.txt, hw04Bench.csv and hw04Bench.json
+    // --bench-shapes=MxNxK,... replaces the suite's shapes
+    // --seed=N generates the same matrices as an earlier run (default: a random seed)
+    int m = 1200, n = 1100, k = 1000;
+    unsigned pool_threads = 0;
+    bool pin = false;
+    bool autotune = false;
+    bool bench = false;
+    vector<BenchShape> bench_shapes = {{64, 64, 64}, {256, 256, 256}, {1024, 1024, 1024}, {2048, 2048, 32}};
+    string forced_kernel;
+    int strassen_cutoff = 0;
+    uint64_t seed = ((uint64_t)random_device()() << 32) | random_device()();
+
+    // The tuning file first, so --kernel overrides the tuned kernel
+    const bool tuning_loaded = loadGemmTuning();
+    for (int i = 1; i < argc; ++i)
     {
-        double difference = fabs(sequential[i] - parallel[i]);
-        if (difference > error)
+        string arg = argv[i];
+        if (arg.compare(0, 10, "--threads=") == 0)
+        {
+            pool_threads = max(0, atoi(arg.c_str() + 10));
+        }
+        else if (arg.compare(0, 7, "--size=") == 0)
+        {
+            if (sscanf(arg.c_str() + 7, "%dx%dx%d", &m, &n, &k) != 3 || m <= 0 || n <= 0 || k <= 0)
+            {
+                cout << "Invalid size: " << arg.substr(7) << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--pin")
+        {
+            pin = true;
+        }
+        else if (arg == "--strassen")
+        {
+            strassen_cutoff = STRASSEN_CUTOFF;
+        }
+        else if (arg.compare(0, 11, "--strassen=") == 0)
+        {
+            strassen_cutoff = atoi(arg.c_str() + 11);
+            if (strassen_cutoff <= 0)
+            {
+                cout << "Invalid Strassen cutoff: " << arg.substr(11) << endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 9, "--kernel=") == 0)
+        {
+            if (forceGemmKernel(arg.c_str() + 9))
+                forced_kernel = arg.substr(9);
+            else
+                cout << "Kernel \"" << arg.substr(9) << "\" is unknown or unsupported on this CPU, using "
+                     << activeGemmKernel().name << endl;
+        }
+        else if (arg.compare(0, 7, "--seed=") == 0)
+        {
+            seed = strtoull(arg.c_str() + 7, NULL, 10);
+        }
+        else if (arg == "--autotune")
+        {
+            autotune = true;
+        }
+        else if (arg == "--bench")
         {
-            error = difference;
+            bench = true;
+        }
+        else if (arg.compare(0, 15, "--bench-shapes=") == 0)
+        {
+            bench = true;
+            bench_shapes.clear();
+            stringstream list(arg.substr(15));
+            string item;
+            while (getline(list, item, ','))
+            {
+                BenchShape shape;
+                if (sscanf(item.c_str(), "%dx%dx%d", &shape.m, &shape.n, &shape.k) != 3 || shape.m <= 0 || shape.n <= 0 || shape.k <= 0)
+                {
+                    cout << "Invalid size: " << item << endl;
+                    return 1;
+                }
+                bench_shapes.push_back(shape);
+            }
+        }
+        else
+        {
+            cout << "Unknown option: " << arg << endl;
         }
     }
-    cout << "Verification Passed! Error: " << error << endl;
-    return true;
-}
 
-int main()
-{
+    if (bench)
+    {
+        // Thread counts 1, 2, 4, ... and the full pool
+        int max_threads = pool_threads ? (int)pool_threads : max(1, (int)thread::hardware_concurrency());
+        vector<int> thread_counts;
+        for (int t = 1; t < max_threads; t *= 2)
+            thread_counts.push_back(t);
+        thread_counts.push_back(max_threads);
+
+        cout << "=== Homework 4: GEMM Benchmark Suite ===" << endl;
+        cout << "Running " << bench_shapes.size() << " shapes on 1.." << max_threads << " threads, every kernel, double/float/mixed" << endl;
+        vector<BenchResult> results = runGemmBench(bench_shapes, thread_counts, pin);
+
+        writeBenchTable(cout, results);
+        ofstream table("hw04Bench.txt"), csv("hw04Bench.csv"), json("hw04Bench.json");
+        writeBenchTable(table, results);
+        writeBenchCsv(csv, results);
+        writeBenchJson(json, results);
+        printf("\n[Success] Benchmark saved to \"hw04Bench.txt\", \"hw04Bench.csv\" and \"hw04Bench.json\"\n");
+        return 0;
+    }
+
     ofstream outFile("hw04Result.txt");
     const int iterations = 5;
 
@@ -114,71 +348,443 @@ int main()
          << "B[" << k << "x" << n << "] = "
          << "C[" << m << "x" << n << "]" << endl;
 
-    cout << "Initializing" << endl;
+    if (autotune)
+    {
+        ThreadPool tune_pool(pool_threads, pin);
+        cout << "Autotuning Blocking (" << m << "x" << n << "x" << k << ", " << tune_pool.size() << " threads)" << endl;
+        vector<GemmTuning> tunings;
+        tunings.push_back(autotuneGemm<double>(m, n, k, timeBatch, &tune_pool));
+        tunings.push_back(autotuneGemm<float>(m, n, k, timeBatch, &tune_pool));
+        for (const GemmTuning &tuning : tunings)
+        {
+            for (const auto &entry : tuning.blockings)
+            {
+                const GemmBlocking &b = entry.second;
+                cout << "  " << tuning.type << " " << entry.first << ": MC=" << b.mc << ", KC=" << b.kc << ", NC=" << b.nc
+                     << ", tiles=" << b.tiles << (entry.first == tuning.kernel ? " (fastest)" : "") << endl;
+            }
+        }
+        if (saveGemmTuning(tunings))
+            cout << "Tuning saved to \"" << gemmTuningPath() << "\"" << endl;
+        else
+            cout << "Could not write \"" << gemmTuningPath() << "\"" << endl;
+
+        // An explicit --kernel still wins over the tuned one
+        if (!forced_kernel.empty())
+            forceGemmKernel(forced_kernel.c_str());
+    }
+    else if (tuning_loaded)
+    {
+        cout << "Using tuned blocking from \"" << gemmTuningPath() << "\"" << endl;
+    }
+
+    // Wall time of every phase, from initialization to verification
+    ThreadPool pool(pool_threads, pin);
+    unsigned int n_threads = pool.size();
+    vector<pair<string, double>> phases;
+    auto phase_start = chrono::high_resolution_clock::now();
+    auto endPhase = [&](const string &name)
+    {
+        auto now = chrono::high_resolution_clock::now();
+        chrono::duration<double> duration = now - phase_start;
+        phases.push_back(make_pair(name, duration.count()));
+        phase_start = now;
+    };
+
+    cout << "Initializing (seed " << seed << ", " << n_threads << " threads)" << endl;
     Matrix A(m * k);
     Matrix B(k * n);
     Matrix C_sequential(m * n);
     Matrix C_parallel(m * n);
+    Matrix C_blocked(m * n);
 
-    matrixInit(A, m, k);
-    matrixInit(B, k, n);
+    matrixInit(pool, A, m, k, seed, 0);
+    matrixInit(pool, B, k, n, seed, 1);
+    endPhase("Initialization");
 
     cout << "Running Sequential Multiplication (Average of " << iterations << " rounds)" << endl;
     double total_seq_time = 0.0;
     for (int i = 0; i < iterations; ++i)
     {
         auto start_seq = chrono::high_resolution_clock::now();
-        sequentialMultiplication(A, B, C_sequential);
+        sequentialMultiplication(A, B, C_sequential, m, n, k);
         auto end_seq = chrono::high_resolution_clock::now();
         chrono::duration<double> duration_seq = end_seq - start_seq;
         total_seq_time += duration_seq.count();
     }
     double avg_seq_time = total_seq_time / iterations;
-    cout << "Average Sequential Time: " << avg_seq_time << " seconds." << endl;
+    cout << "Average Sequential Time: " << avg_seq_time << " seconds. (" << gflops(avg_seq_time, m, n, k) << " GFLOPS)" << endl;
+    endPhase("Sequential");
 
-    unsigned int n_threads = thread::hardware_concurrency();
-    cout << "Running Parallel Multiplication (" << (n_threads ? n_threads : 4) << " threads, Average of " << iterations << " rounds)" << endl;
+    const GemmKernel &kernel = activeGemmKernel();
+    GemmBlocking blocking = defaultBlocking(kernel);
+    const bool tuned = tunedBlocking<double>(kernel.name) != NULL;
+    cout << "Running Blocked Multiplication (MC=" << blocking.mc << ", KC=" << blocking.kc << ", NC=" << blocking.nc
+         << (tuned ? " tuned" : "") << ", " << kernel.name << " " << kernel.mr << "x" << kernel.nr << " microkernel, Average of " << iterations << " rounds)" << endl;
+    double total_blk_time = 0.0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        auto start_blk = chrono::high_resolution_clock::now();
+        blockedMultiplication(A, B, C_blocked, m, n, k);
+        auto end_blk = chrono::high_resolution_clock::now();
+        chrono::duration<double> duration_blk = end_blk - start_blk;
+        total_blk_time += duration_blk.count();
+    }
+    double avg_blk_time = total_blk_time / iterations;
+    cout << "Average Blocked Time: " << avg_blk_time << " seconds. (" << gflops(avg_blk_time, m, n, k) << " GFLOPS)" << endl;
+    double blk_speedup = avg_seq_time / avg_blk_time;
+    endPhase("Blocked");
+
+    cout << "Running Parallel Multiplication (" << n_threads << " threads" << (pin ? ", pinned" : "") << ", Average of " << iterations << " rounds)" << endl;
     double total_par_time = 0.0;
     for (int i = 0; i < iterations; ++i)
     {
         auto start_par = chrono::high_resolution_clock::now();
-        parallelMultiplication(A, B, C_parallel);
+        parallelMultiplication(pool, A, B, C_parallel, m, n, k);
         auto end_par = chrono::high_resolution_clock::now();
         chrono::duration<double> duration_par = end_par - start_par;
         total_par_time += duration_par.count();
     }
     double avg_par_time = total_par_time / iterations;
-    cout << "Average Parallel Time: " << avg_par_time << " seconds." << endl;
+    cout << "Average Parallel Time: " << avg_par_time << " seconds. (" << gflops(avg_par_time, m, n, k) << " GFLOPS)" << endl;
 
     double speedup = avg_seq_time / avg_par_time;
     cout << "Speedup: " << speedup << " Times" << endl;
+    endPhase("Parallel");
+
+    // Single precision: the same inputs rounded to float
+    MatrixF A_float(A.begin(), A.end()), B_float(B.begin(), B.end());
+    MatrixF C_float(m * n);
+    const GemmKernelF &kernel_float = activeGemmKernel<float>();
+    cout << "Running Single-Precision Parallel Multiplication (" << kernel_float.name << " " << kernel_float.mr << "x" << kernel_float.nr
+         << " microkernel, Average of " << iterations << " rounds)" << endl;
+    double avg_float_time = timeRounds([&]()
+                                       { parallelMultiplication(pool, A_float, B_float, C_float, m, n, k); },
+                                       iterations);
+    cout << "Average Single-Precision Time: " << avg_float_time << " seconds. (" << gflops(avg_float_time, m, n, k) << " GFLOPS)" << endl;
+    endPhase("Single-Precision");
+
+    // Mixed precision: float inputs, double accumulation and output
+    Matrix C_mixed(m * n);
+    cout << "Running Mixed-Precision Parallel Multiplication (float in, double accumulate, Average of " << iterations << " rounds)" << endl;
+    double avg_mixed_time = timeRounds([&]()
+                                       { parallelMultiplication(pool, A_float, B_float, C_mixed, m, n, k); },
+                                       iterations);
+    cout << "Average Mixed-Precision Time: " << avg_mixed_time << " seconds. (" << gflops(avg_mixed_time, m, n, k) << " GFLOPS)" << endl;
+    endPhase("Mixed-Precision");
+
+    // Strassen-Winograd: fewer flops, more error per level. GFLOPS counts the
+    // classical 2mnk, so it shows the effective rate.
+    Matrix C_strassen;
+    double avg_strassen_time = 0, strassen_error = 0;
+    int strassen_depth = 0;
+    if (strassen_cutoff > 0)
+    {
+        C_strassen.resize(m * n);
+        strassen_depth = strassenDepth(m, n, k, strassen_cutoff);
+        PackBuffer<double> workspace;
+        size_t workspace_size = strassenWorkspaceSize(m, n, k, strassen_cutoff, &pool);
+        workspace.get(workspace_size);
+        cout << "Running Strassen Multiplication (cutoff " << strassen_cutoff << ", " << strassen_depth << " levels, "
+             << workspace_size * sizeof(double) / (1024 * 1024) << " MiB workspace, Average of " << iterations << " rounds)" << endl;
+        avg_strassen_time = timeRounds([&]()
+                                       { gemmStrassen(m, n, k, A.data(), k, B.data(), n, C_strassen.data(), n, workspace, &pool, strassen_cutoff); },
+                                       iterations);
+        strassen_error = relativeError(pool, C_sequential, C_strassen);
+        cout << "Average Strassen Time: " << avg_strassen_time << " seconds. (" << gflops(avg_strassen_time, m, n, k) << " effective GFLOPS)" << endl;
+        endPhase("Strassen");
+    }
+
+    // Scaling sweep: the same parallel multiplication on pools of 1..n_threads threads
+    cout << "Running Scaling Sweep (1.." << n_threads << " threads)" << endl;
+    vector<double> sweep_time(n_threads + 1);
+    for (unsigned int t = 1; t <= n_threads; ++t)
+    {
+        ThreadPool sweep_pool(t, pin);
+        double total = 0.0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            auto start_sweep = chrono::high_resolution_clock::now();
+            parallelMultiplication(sweep_pool, A, B, C_parallel, m, n, k);
+            auto end_sweep = chrono::high_resolution_clock::now();
+            chrono::duration<double> duration_sweep = end_sweep - start_sweep;
+            total += duration_sweep.count();
+        }
+        sweep_time[t] = total / iterations;
+        cout << "  " << t << " threads: " << sweep_time[t] << " seconds. (" << gflops(sweep_time[t], m, n, k) << " GFLOPS)" << endl;
+    }
+    endPhase("Scaling Sweep");
+
+    // Storage: the same parallel product with operands in vector<double>, in aligned,
+    // padded GemmMatrix and in GemmMatrix on huge pages. 1024^3 has the power-of-two
+    // rows the padding is for.
+    const int storage_sizes[2][3] = {{m, n, k}, {1024, 1024, 1024}};
+    const char *storage_names[3] = {"vector", "aligned", "huge pages"};
+    double storage_time[2][3];
+    bool storage_huge = false;
+    Matrix C_storage(m * n);
+    cout << "Running Storage Comparison (vector<double> vs GemmMatrix, Average of " << iterations << " rounds)" << endl;
+    for (int s = 0; s < 2; ++s)
+    {
+        int sm = storage_sizes[s][0], sn = storage_sizes[s][1], sk = storage_sizes[s][2];
+        Matrix a = A, b = B, c(sm * sn);
+        if (s > 0)
+        {
+            a.resize(sm * sk);
+            b.resize(sk * sn);
+            matrixInit(pool, a, sm, sk, seed, 16);
+            matrixInit(pool, b, sk, sn, seed, 17);
+        }
+        storage_time[s][0] = timeRounds([&]()
+                                        { parallelMultiplication(pool, a, b, c, sm, sn, sk); },
+                                        iterations);
+        for (int v = 1; v < 3; ++v)
+        {
+            GemmMatrix<double> ga(sm, sk, v == 2), gb(sk, sn, v == 2), gc(sm, sn, v == 2);
+            ga.assign(a.data(), sk);
+            gb.assign(b.data(), sn);
+            storage_time[s][v] = timeRounds([&]()
+                                            { gemm(GemmNoTrans, GemmNoTrans, 1.0, ga, gb, 0.0, gc, &pool); },
+                                            iterations);
+            if (v == 2)
+            {
+                storage_huge |= ga.usesHugePages();
+                if (s == 0)
+                    gc.copyTo(C_storage.data(), n);
+            }
+        }
+        cout << "  " << sm << "x" << sn << "x" << sk << ":";
+        for (int v = 0; v < 3; ++v)
+            cout << " " << storage_names[v] << " " << storage_time[s][v] << " s" << (v < 2 ? "," : "");
+        cout << endl;
+    }
+    endPhase("Storage");
+
+    // Small products only gain from threads if handing work to the pool costs little
+    const int small = 64;
+    Matrix A_small(small * small), B_small(small * small), C_small(small * small);
+    matrixInit(pool, A_small, small, small, seed, 2);
+    matrixInit(pool, B_small, small, small, seed, 3);
+    cout << "Running Small Multiplication (" << small << "x" << small << "x" << small << ")" << endl;
+    double dispatch_time = timeSmall([&]()
+                                     { pool.parallelFor(pool.size(), [](int, int) {}); });
+    double small_blk_time = timeSmall([&]()
+                                      { gemmBlocked(small, small, small, A_small.data(), small, B_small.data(), small, C_small.data(), small); });
+    double small_par_time = timeSmall([&]()
+                                      { gemmParallel(pool, small, small, small, A_small.data(), small, B_small.data(), small, C_small.data(), small); });
+    double small_speedup = small_blk_time / small_par_time;
+    cout << "Pool Dispatch Latency: " << dispatch_time * 1e6 << " us" << endl;
+    cout << "Small Blocked: " << small_blk_time * 1e6 << " us, Small Parallel: " << small_par_time * 1e6
+         << " us (Speedup: " << small_speedup << " Times)" << endl;
+
+    // Fixed sizes: gemm() dispatches these to the fully unrolled kernels of GemmSmall.h
+    const int fixed_sizes[] = {4, 8, 16};
+    double fixed_time[3], fixed_blk_time[3];
+    for (int s = 0; s < 3; ++s)
+    {
+        int f = fixed_sizes[s];
+        double *a = A_small.data(), *b = B_small.data(), *c = C_small.data();
+        fixed_time[s] = timeSmall([&]()
+                                  { gemm(GemmRowMajor, GemmNoTrans, GemmNoTrans, f, f, f, 1.0, a, f, b, f, 0.0, c, f); });
+        fixed_blk_time[s] = timeSmall([&]()
+                                      { gemmBlocked(f, f, f, a, f, b, f, c, f); });
+        cout << "Fixed " << f << "x" << f << "x" << f << ": Unrolled " << fixed_time[s] * 1e9 << " ns, Blocked "
+             << fixed_blk_time[s] * 1e9 << " ns" << endl;
+    }
+    endPhase("Small/Fixed");
+
+    // Batches of independent square products, serial loop vs spread over the pool.
+    // Operands are capped at batch_cap doubles each, so the largest batches of the
+    // largest sizes are skipped rather than allocating gigabytes.
+    const int batch_sizes[] = {2, 4, 8, 16, 32, 64};
+    const int batch_counts[] = {1, 10, 100, 1000, 10000, 100000};
+    const size_t batch_cap = (size_t)1 << 24;
+    double batch_time[6][6], batch_serial_time[6][6];
+    bool batch_passed = true;
+    cout << "Running Batched Multiplication (sizes 2..64, batches 1..100000)" << endl;
+    for (int s = 0; s < 6; ++s)
+    {
+        int f = batch_sizes[s];
+        int most = (int)min<size_t>(batch_counts[5], batch_cap / (f * f));
+        Matrix A_batch((size_t)most * f * f), B_batch((size_t)most * f * f), C_batch((size_t)most * f * f);
+        matrixInit(pool, A_batch, most, f * f, seed, 4 + 2 * s);
+        matrixInit(pool, B_batch, most, f * f, seed, 5 + 2 * s);
+        const double *a = A_batch.data(), *b = B_batch.data();
+        double *c = C_batch.data();
+        ptrdiff_t stride = f * f;
+
+        int last = 0;
+        for (int t = 0; t < 6; ++t)
+        {
+            int count = batch_counts[t];
+            if (count > most)
+            {
+                batch_time[s][t] = batch_serial_time[s][t] = 0;
+                continue;
+            }
+            batch_serial_time[s][t] = timeBatch([&]()
+                                                { gemmBatchedStrided(GemmRowMajor, GemmNoTrans, GemmNoTrans, f, f, f, 1.0, a, f, stride, b, f, stride, 0.0, c, f, stride, count); });
+            batch_time[s][t] = timeBatch([&]()
+                                         { gemmBatchedStrided(GemmRowMajor, GemmNoTrans, GemmNoTrans, f, f, f, 1.0, a, f, stride, b, f, stride, 0.0, c, f, stride, count, &pool); });
+            last = t;
+        }
+
+        // The last entry of the largest batch timed against the naive loop
+        size_t offset = ((size_t)batch_counts[last] - 1) * stride;
+        Matrix a_last(A_batch.begin() + offset, A_batch.begin() + offset + stride);
+        Matrix b_last(B_batch.begin() + offset, B_batch.begin() + offset + stride);
+        Matrix c_last(stride), c_batch(C_batch.begin() + offset, C_batch.begin() + offset + stride);
+        sequentialMultiplication(a_last, b_last, c_last, f, f, f);
+        batch_passed &= verification(pool, "Batched " + to_string(f), c_last, c_batch, tolerance<double, double>(f));
+
+        cout << "Batched " << f << "x" << f << "x" << f << " (" << gemmBatchPathName(gemmBatchPath(GemmRowMajor, GemmNoTrans, GemmNoTrans, f, f, f))
+             << "): " << batch_counts[last] << " entries in " << batch_time[s][last] * 1e6 << " us (serial "
+             << batch_serial_time[s][last] * 1e6 << " us)" << endl;
+    }
+    endPhase("Batched");
 
     cout << "Verifying results..." << endl;
-    verification(C_sequential, C_parallel);
+    bool passed = batch_passed;
+    passed &= verification(pool, "Parallel", C_sequential, C_parallel, tolerance<double, double>(k));
+    passed &= verification(pool, "Blocked", C_sequential, C_blocked, tolerance<double, double>(k));
+    passed &= verification(pool, "Single-Precision", C_sequential, C_float, tolerance<float, float>(k));
+    passed &= verification(pool, "GemmMatrix", C_sequential, C_storage, tolerance<double, double>(k));
+    passed &= verification(pool, "Mixed-Precision", C_sequential, C_mixed, tolerance<float, double>(k));
+    // Each Winograd level may multiply the normwise error bound by up to 18
+    if (strassen_cutoff > 0)
+        passed &= verification(pool, "Strassen", C_sequential, C_strassen, tolerance<double, double>(k) * pow(18.0, strassen_depth));
+    endPhase("Verification");
+
+    cout << "Phase Times:" << endl;
+    double total_time = 0;
+    for (const auto &phase : phases)
+    {
+        cout << "  " << phase.first << ": " << phase.second << " seconds" << endl;
+        total_time += phase.second;
+    }
+    cout << "  Total: " << total_time << " seconds" << endl;
 
     if (outFile.is_open())
     {
-        outFile << "=============================================================================" << endl;
-        outFile << "                      Homework 4: Matrix Multiplication                      " << endl;
-        outFile << "=============================================================================" << endl;
+        outFile << "==========================================================================================" << endl;
+        outFile << "                            Homework 4: Matrix Multiplication                             " << endl;
+        outFile << "==========================================================================================" << endl;
 
         outFile << left << setw(18) << "Matrix Dimensions: " << setw(12) << ("A[" + to_string(m) + "x" + to_string(k) + "] * ")
                 << setw(12) << ("B[" + to_string(k) + "x" + to_string(n) + "] = ")
                 << setw(12) << ("C[" + to_string(m) + "x" + to_string(n) + "]") << endl;
+        outFile << left << setw(18) << "Blocking: " << "MC=" << blocking.mc << ", KC=" << blocking.kc << ", NC=" << blocking.nc
+                << ", tiles=" << blocking.tiles << (tuned ? " (tuned)" : " (cache heuristic)") << endl;
+        outFile << left << setw(18) << "Microkernel: " << kernel.name << " (" << kernel.mr << "x" << kernel.nr << " double, "
+                << kernel_float.mr << "x" << kernel_float.nr << " float)" << endl;
+        outFile << left << setw(18) << "Seed: " << seed << " (--seed=" << seed << " regenerates these matrices)" << endl;
+        if (strassen_cutoff > 0)
+            outFile << left << setw(18) << "Strassen: " << "cutoff " << strassen_cutoff << ", " << strassen_depth << " levels, relative error "
+                    << strassen_error << " (parallel: " << relativeError(pool, C_sequential, C_parallel) << ")" << endl;
+        outFile << endl;
+
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "|     Type     |  Threads   |  Avg Time (Seconds)  |   GFLOPS   |        Speedup         |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+
+        outFile << "|Sequential    | 1          | " << setw(20) << avg_seq_time << " | " << setw(10) << gflops(avg_seq_time, m, n, k) << " | 1                      |" << endl;
+        outFile << "|Blocked       | 1          | " << setw(20) << avg_blk_time << " | " << setw(10) << gflops(avg_blk_time, m, n, k) << " | " << setw(20) << blk_speedup << "   |" << endl;
+        outFile << "|Parallel      | " << setw(10) << n_threads << " | " << setw(20) << avg_par_time << " | " << setw(10) << gflops(avg_par_time, m, n, k) << " | " << setw(20) << speedup << "   |" << endl;
+        outFile << "|Single (f32)  | " << setw(10) << n_threads << " | " << setw(20) << avg_float_time << " | " << setw(10) << gflops(avg_float_time, m, n, k) << " | " << setw(20) << avg_seq_time / avg_float_time << "   |" << endl;
+        outFile << "|Mixed (f32in) | " << setw(10) << n_threads << " | " << setw(20) << avg_mixed_time << " | " << setw(10) << gflops(avg_mixed_time, m, n, k) << " | " << setw(20) << avg_seq_time / avg_mixed_time << "   |" << endl;
+        if (strassen_cutoff > 0)
+            outFile << "|Strassen      | " << setw(10) << n_threads << " | " << setw(20) << avg_strassen_time << " | " << setw(10) << gflops(avg_strassen_time, m, n, k) << " | " << setw(20) << avg_seq_time / avg_strassen_time << "   |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
         outFile << endl;
 
-        outFile << "|--------------|------------|----------------------|------------------------|" << endl;
-        outFile << "|     Type     |  Threads   |  Avg Time (Seconds)  |        Speedup         |" << endl;
-        outFile << "|--------------|------------|----------------------|------------------------|" << endl;
+        outFile << left << setw(18) << "Scaling: " << "parallel multiplication, 1.." << n_threads << " threads" << (pin ? " (pinned)" : "") << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "|  Efficiency  |  Threads   |  Avg Time (Seconds)  |   GFLOPS   |  Speedup (vs 1 thread) |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        for (unsigned int t = 1; t <= n_threads; ++t)
+        {
+            double scale = sweep_time[1] / sweep_time[t];
+            outFile << "|" << setw(13) << (to_string((int)lround(100 * scale / t)) + "%") << " | " << setw(10) << t << " | " << setw(20) << sweep_time[t]
+                    << " | " << setw(10) << gflops(sweep_time[t], m, n, k) << " | " << setw(20) << scale << "   |" << endl;
+        }
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << endl;
+
+        outFile << left << setw(18) << "Storage: " << "parallel multiplication on " << n_threads << " threads, 64-byte aligned and padded GemmMatrix"
+                << (storage_huge ? ", huge pages granted" : ", huge pages declined") << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "|     Size     |  Storage   |  Avg Time (Seconds)  |   GFLOPS   |  Speedup (vs vector)   |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        for (int s = 0; s < 2; ++s)
+        {
+            int sm = storage_sizes[s][0], sn = storage_sizes[s][1], sk = storage_sizes[s][2];
+            string size = s == 0 ? "Main product" : "1024x1024";
+            for (int v = 0; v < 3; ++v)
+                outFile << "|" << setw(13) << size << " | " << setw(10) << storage_names[v] << " | " << setw(20) << storage_time[s][v] << " | " << setw(10)
+                        << gflops(storage_time[s][v], sm, sn, sk) << " | " << setw(20) << storage_time[s][0] / storage_time[s][v] << "   |" << endl;
+        }
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << endl;
+
+        outFile << left << setw(18) << "Small Matrices: " << small << "x" << small << "x" << small
+                << ", pool dispatch latency " << dispatch_time * 1e6 << " us" << (pin ? " (pinned)" : "") << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "|Blocked       | 1          | " << setw(20) << small_blk_time << " | " << setw(10) << gflops(small_blk_time, small, small, small) << " | 1                      |" << endl;
+        outFile << "|Parallel      | " << setw(10) << n_threads << " | " << setw(20) << small_par_time << " | " << setw(10) << gflops(small_par_time, small, small, small) << " | " << setw(20) << small_speedup << "   |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << endl;
+
+        outFile << left << setw(18) << "Fixed Sizes: " << "unrolled gemm() path vs blocked kernel" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "|     Size     |    Path    |  Avg Time (Seconds)  |   GFLOPS   | Speedup (vs blocked)   |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        for (int s = 0; s < 3; ++s)
+        {
+            int f = fixed_sizes[s];
+            string size = to_string(f) + "x" + to_string(f) + "x" + to_string(f);
+            outFile << "|" << setw(13) << size << " | Blocked    | " << setw(20) << fixed_blk_time[s] << " | " << setw(10) << gflops(fixed_blk_time[s], f, f, f) << " | 1                      |" << endl;
+            outFile << "|" << setw(13) << size << " | Unrolled   | " << setw(20) << fixed_time[s] << " | " << setw(10) << gflops(fixed_time[s], f, f, f) << " | " << setw(20) << fixed_blk_time[s] / fixed_time[s] << "   |" << endl;
+        }
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << endl;
+
+        outFile << left << setw(18) << "Batched: " << "square products, strided batch on " << n_threads << " threads vs serial loop" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << "| Size (Path)  |   Batch    |  Avg Time (Seconds)  |   GFLOPS   | Speedup (vs serial)    |" << endl;
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        for (int s = 0; s < 6; ++s)
+        {
+            int f = batch_sizes[s];
+            string size = to_string(f) + " (" + gemmBatchPathName(gemmBatchPath(GemmRowMajor, GemmNoTrans, GemmNoTrans, f, f, f)) + ")";
+            for (int t = 0; t < 6; ++t)
+            {
+                int count = batch_counts[t];
+                if (batch_time[s][t] == 0)
+                {
+                    outFile << "|" << setw(13) << size << " | " << setw(10) << count << " | " << setw(20) << "skipped (memory)" << " | " << setw(10) << "-" << " | -                      |" << endl;
+                    continue;
+                }
+                outFile << "|" << setw(13) << size << " | " << setw(10) << count << " | " << setw(20) << batch_time[s][t] << " | " << setw(10) << gflops(batch_time[s][t], f, f, f) * count
+                        << " | " << setw(20) << batch_serial_time[s][t] / batch_time[s][t] << "   |" << endl;
+            }
+        }
+        outFile << "|--------------|------------|----------------------|------------|------------------------|" << endl;
+        outFile << endl;
 
-        outFile << "|Sequential    | 1          | " << setw(20) << avg_seq_time << " | 1                      |" << endl;
-        outFile << "|Parallel      | " << setw(10) << (n_threads ? n_threads : 4) << " | " << setw(20) << avg_par_time << " | " << setw(20) << speedup << "   |" << endl;
-        outFile << "|--------------|------------|----------------------|------------------------|" << endl;
-        outFile << "=============================================================================" << endl;
+        outFile << left << setw(18) << "Phases: " << "wall time of each phase of this run, " << n_threads << " threads" << endl;
+        outFile << "|------------------------------|----------------------|----------------------------------|" << endl;
+        outFile << "|            Phase             |    Time (Seconds)    |             Share                |" << endl;
+        outFile << "|------------------------------|----------------------|----------------------------------|" << endl;
+        for (const auto &phase : phases)
+            outFile << "|" << setw(29) << phase.first << " | " << setw(20) << phase.second << " | " << setw(32)
+                    << (to_string((int)lround(100 * phase.second / total_time)) + "%") << " |" << endl;
+        outFile << "|" << setw(29) << "Total" << " | " << setw(20) << total_time << " | " << setw(32) << "100%" << " |" << endl;
+        outFile << "|------------------------------|----------------------|----------------------------------|" << endl;
+        outFile << "==========================================================================================" << endl;
 
         printf("\n[Success] Report saved to \"hw04Result.txt\"\n");
         outFile.close();
     }
 
-    return 0;
+    return passed ? 0 : 1;
 }
\ No newline at end of file